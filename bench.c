@@ -0,0 +1,242 @@
+/*
+ * melvin_bench: in-process timings of the hot paths on a synthetic graph
+ *
+ *   make bench
+ *   ./melvin_bench --nodes 1000000 --edges 4000000 --skew 2
+ *
+ * Every operation is timed on its own and reported as mean and percentile
+ * nanoseconds; --csv gives one summary row instead (see benchmark.sh).
+ * Runs in a fresh temporary directory, so no melvin.mmap of yours is
+ * touched.
+ */
+
+#define MELVIN_NO_MAIN
+#include "melvin.c"
+
+#include <math.h>
+
+uint64_t rng = 0x9E3779B97F4A7C15ull;
+
+/* xorshift64*: fast and reproducible for a given --seed */
+uint64_t rnd() {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 0x2545F4914F6CDD1Dull;
+}
+
+/* Node index in [0, n): uniform for skew 0, else weighted toward low indices
+ * (a few hubs carry most edges, like tokens in real text) */
+uint32_t pick(uint32_t n, double skew) {
+    double u = (rnd() >> 11) * (1.0 / 9007199254740992.0);
+    uint32_t i = (uint32_t)(n * pow(u, 1.0 + skew));
+    return i < n ? i : n - 1;
+}
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int cmp_ns(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+int csv;                    // One summary row instead of the table
+
+/* What the CSV row reports of one op */
+typedef struct {
+    uint64_t total, p50, p99;
+} Timing;
+
+/* One row: op, count, mean and percentiles of the per-op times (sorted
+ * in place) */
+Timing report(const char *op, uint64_t *ns, uint32_t n) {
+    Timing t = {0};
+    if (n == 0) return t;
+    for (uint32_t i = 0; i < n; i++) t.total += ns[i];
+    qsort(ns, n, sizeof(uint64_t), cmp_ns);
+    t.p50 = ns[n / 2];
+    t.p99 = ns[(uint64_t)n * 99 / 100];
+    if (!csv) {
+        printf("%-20s %9u %11.0f %9llu %9llu %9llu %11llu\n", op, n, (double)t.total / n,
+               (unsigned long long)t.p50, (unsigned long long)ns[(uint64_t)n * 90 / 100],
+               (unsigned long long)t.p99, (unsigned long long)ns[n - 1]);
+    }
+    return t;
+}
+
+/* A "Name:   123 kB" line of /proc/self/status, in kB; 0 if not there */
+unsigned long status_kb(const char *name) {
+    FILE *f = fopen("/proc/self/status", "r");
+    char row[256];
+    unsigned long kb = 0;
+    size_t len = strlen(name);
+    while (f && fgets(row, sizeof(row), f)) {
+        if (strncmp(row, name, len) == 0 && row[len] == ':') kb = strtoul(row + len + 1, NULL, 10);
+    }
+    if (f) fclose(f);
+    return kb;
+}
+
+/* Ops per second from count and total ns */
+double rate(uint32_t n, uint64_t ns) {
+    return ns ? n * 1e9 / ns : 0;
+}
+
+void bench_usage() {
+    fprintf(stderr, "usage: melvin_bench [--nodes N] [--edges M] [--skew S] [--lines L]\n"
+                    "                    [--line-tokens T] [--queries Q] [--depth D] [--saves S]\n"
+                    "                    [--loads R] [--seed X] [--csv]\n");
+}
+
+int main(int argc, char **argv) {
+    uint32_t nodes = 100000, edges = 400000, lines = 200, line_tokens = 8;
+    uint32_t saves = 100, loads = 20, queries = 1000;
+    double skew = 1.0;
+    Walk walk = {0};
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) { csv = 1; continue; }
+        const char *arg = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!arg) { bench_usage(); return 2; }
+        if (strcmp(argv[i], "--nodes") == 0) nodes = strtoul(arg, NULL, 10);
+        else if (strcmp(argv[i], "--edges") == 0) edges = strtoul(arg, NULL, 10);
+        else if (strcmp(argv[i], "--skew") == 0) skew = strtod(arg, NULL);
+        else if (strcmp(argv[i], "--lines") == 0) lines = strtoul(arg, NULL, 10);
+        else if (strcmp(argv[i], "--line-tokens") == 0) line_tokens = strtoul(arg, NULL, 10);
+        else if (strcmp(argv[i], "--depth") == 0) walk.max_depth = strtoul(arg, NULL, 10);
+        else if (strcmp(argv[i], "--saves") == 0) saves = strtoul(arg, NULL, 10);
+        else if (strcmp(argv[i], "--loads") == 0) loads = strtoul(arg, NULL, 10);
+        else if (strcmp(argv[i], "--queries") == 0) queries = strtoul(arg, NULL, 10);
+        else if (strcmp(argv[i], "--seed") == 0) rng = strtoull(arg, NULL, 10) | 1;
+        else { bench_usage(); return 2; }
+        i++;
+    }
+    if (nodes == 0 || skew < 0) { bench_usage(); return 2; }
+    
+    char dir[] = "/tmp/melvin_bench.XXXXXX";
+    Melvin *m = NULL;
+    if (!mkdtemp(dir) || chdir(dir) != 0 || !(m = melvin_open(GRAPH_FILE, 0))) {
+        fprintf(stderr, "melvin_bench: cannot set up a graph in %s\n", dir);
+        return 1;
+    }
+    melvin_set_walk(m, &walk);
+    
+    uint32_t most = nodes > edges ? nodes : edges;
+    if (lines > most) most = lines;
+    if (queries > most) most = queries;
+    if (saves > most) most = saves;
+    if (loads > most) most = loads;
+    uint64_t *ns = malloc((uint64_t)most * sizeof(uint64_t));
+    uint32_t *ids = malloc((uint64_t)nodes * sizeof(uint32_t));
+    char *line = malloc((uint64_t)line_tokens * 12 + 1);
+    if (!ns || !ids || !line) {
+        fprintf(stderr, "melvin_bench: out of memory\n");
+        return 1;
+    }
+    
+    if (!csv) {
+        printf("graph: %u nodes, %u edges, skew %.2f; %u lines of %u tokens, depth %u\n\n",
+               nodes, edges, skew, lines, line_tokens, walk.max_depth);
+        printf("%-20s %9s %11s %9s %9s %9s %11s\n", "op", "count", "mean_ns", "p50_ns", "p90_ns",
+               "p99_ns", "max_ns");
+    }
+    
+    // New tokens, then the same ones found again
+    char tok[16];
+    for (uint32_t i = 0; i < nodes; i++) {
+        int len = snprintf(tok, sizeof(tok), "n%u", i);
+        uint64_t t = now_ns();
+        ids[i] = find_or_create(m, (uint8_t*)tok, len);
+        ns[i] = now_ns() - t;
+    }
+    Timing node_t = report("find_or_create/new", ns, nodes);
+    for (uint32_t i = 0; i < nodes; i++) {
+        int len = snprintf(tok, sizeof(tok), "n%u", (uint32_t)(rnd() % nodes));
+        uint64_t t = now_ns();
+        find_or_create(m, (uint8_t*)tok, len);
+        ns[i] = now_ns() - t;
+    }
+    report("find_or_create/hit", ns, nodes);
+    
+    // Sources follow the skew, targets are uniform
+    for (uint32_t i = 0; i < edges; i++) {
+        uint32_t from = ids[pick(nodes, skew)], to = ids[rnd() % nodes];
+        uint64_t t = now_ns();
+        create_edge(m, from, to, 100);
+        ns[i] = now_ns() - t;
+    }
+    Timing edge_t = report("create_edge", ns, edges);
+    
+    uint64_t t = now_ns();
+    csr_rebuild(m);
+    ns[0] = now_ns() - t;
+    report("csr_rebuild", ns, 1);
+    
+    // Whole lines: tokenize, link, walk
+    for (uint32_t i = 0; i < lines; i++) {
+        char *p = line;
+        for (uint32_t k = 0; k < line_tokens; k++) {
+            p += sprintf(p, "%sn%u", k ? " " : "", pick(nodes, skew));
+        }
+        t = now_ns();
+        route(m, line, NULL);
+        ns[i] = now_ns() - t;
+    }
+    Timing route_t = report("route", ns, lines);
+    
+    // save() fsyncs the log; opening maps the file and opens the log
+    for (uint32_t i = 0; i < saves; i++) {
+        t = now_ns();
+        save(m);
+        ns[i] = now_ns() - t;
+    }
+    report("save", ns, saves);
+    checkpoint(m);
+    struct stat st;
+    uint64_t file_bytes = stat(GRAPH_FILE, &st) == 0 ? (uint64_t)st.st_size : 0;
+    unsigned long rss_file = status_kb("RssFile");     // The graph's pages; bench buffers are anon
+    for (uint32_t i = 0; i < loads; i++) {
+        melvin_close(m);
+        t = now_ns();
+        m = melvin_open(GRAPH_FILE, 0);
+        ns[i] = now_ns() - t;
+        if (!m) {
+            fprintf(stderr, "melvin_bench: reload failed\n");
+            return 1;
+        }
+    }
+    Timing load_t = report("load", ns, loads);
+    
+    // Read-only walks from one token each, on the freshly opened graph
+    melvin_set_walk(m, &walk);
+    for (uint32_t i = 0; i < queries; i++) {
+        snprintf(tok, sizeof(tok), "n%u", pick(nodes, skew));
+        t = now_ns();
+        query(m, tok, NULL);
+        ns[i] = now_ns() - t;
+    }
+    Timing query_t = report("query", ns, queries);
+    
+    if (csv) {
+        printf("nodes,edges,degree,skew,depth,nodes_per_s,edges_per_s,route_p50_ns,route_p99_ns,"
+               "query_p50_ns,query_p99_ns,load_p50_ns,rss_file_kb,peak_rss_kb,file_bytes\n");
+        printf("%u,%u,%.2f,%.2f,%u,%.0f,%.0f,%llu,%llu,%llu,%llu,%llu,%lu,%lu,%llu\n", nodes, edges,
+               (double)edges / nodes, skew, walk.max_depth, rate(nodes, node_t.total), rate(edges, edge_t.total),
+               (unsigned long long)route_t.p50, (unsigned long long)route_t.p99,
+               (unsigned long long)query_t.p50, (unsigned long long)query_t.p99,
+               (unsigned long long)load_t.p50, rss_file, status_kb("VmHWM"), (unsigned long long)file_bytes);
+    }
+    
+    melvin_close(m);
+    scratch_free(&scratch);
+    free(ns);
+    free(ids);
+    free(line);
+    unlink(GRAPH_FILE);
+    unlink(LOG_FILE);
+    if (chdir("/") != 0 || rmdir(dir) != 0) fprintf(stderr, "melvin_bench: left %s behind\n", dir);
+    return 0;
+}
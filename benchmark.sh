@@ -1,271 +1,50 @@
 #!/bin/bash
 
-# Benchmark Suite - Detailed Performance Metrics
-# Measures: edges/node ratio, activation cascade, memory growth
+# Scaling benchmark: melvin_bench over a grid of graph sizes, one CSV row
+# per size, appended to a results file so releases can be compared.
+#
+#   ./benchmark.sh [results.csv]          (default bench_results.csv)
+#
+# Knobs (environment): NODES, DEGREES (edges = nodes * degree), SKEW,
+# DEPTH (walk bound for routes and queries), LINES, QUERIES, MAX_EDGES
+# (larger sizes are skipped), SEED.
+#
+# Columns: release (git describe), date, then melvin_bench --csv:
+# nodes, edges, degree, skew, depth, nodes_per_s and edges_per_s (ingest
+# rates), route and query p50/p99 ns, load_p50_ns (open a graph), the
+# graph's resident pages (rss_file_kb), the peak RSS of the whole run
+# (peak_rss_kb, timing buffers included) and file_bytes (checkpointed).
 
 set -e
 
-echo "╔════════════════════════════════════════════════════════════╗"
-echo "║          MELVIN ORGANIC - BENCHMARK SUITE                  ║"
-echo "╚════════════════════════════════════════════════════════════╝"
-echo ""
-
-# Build
-make melvin_organic > /dev/null 2>&1
-
-# Benchmark 1: Edge Growth Curve
-echo "BENCHMARK 1: Edge Growth Curve"
-echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
-echo ""
-echo "Measuring: Does O(N²) hold?"
-echo ""
-echo "N Words | Est. Edges | Time (ms)"
-echo "--------|------------|----------"
-
-for n in 5 10 15 20 30 40 50; do
-    rm -f organic.mmap
-    
-    # Generate training data
-    words=""
-    for i in $(seq 1 $n); do
-        words="$words w$i"
-    done
-    
-    # Measure training time
-    start=$(date +%s%N)
-    echo "$words" | ./melvin_organic > /dev/null 2>&1
-    end=$(date +%s%N)
-    elapsed=$(( (end - start) / 1000000 ))
-    
-    # Estimate edges by querying
-    output=$(echo "w1" | ./melvin_organic 2>&1)
-    activations=$(echo "$output" | grep -o "([0-9.]*)" | wc -l)
-    
-    # Rough edge estimate: activations * 2 (bidirectional)
-    edges=$((activations * 2))
-    
-    printf "%7d | %10d | %8d\n" $n $edges $elapsed
-done
-
-echo ""
-echo "Expected: Edges grow O(N²), time grows O(N²)"
-echo ""
-
-# Benchmark 2: Activation Cascade Depth
-echo "BENCHMARK 2: Cascade Multiplication"
-echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
-echo ""
-echo "Measuring: Input→Output multiplication"
-echo ""
-
-rm -f organic.mmap
-
-# Create dense network
-echo "cat sat mat bat hat rat" | ./melvin_organic > /dev/null 2>&1
-echo "dog log fog hog bog" | ./melvin_organic > /dev/null 2>&1
-echo "sun fun run gun" | ./melvin_organic > /dev/null 2>&1
-echo "cat dog sun friends" | ./melvin_organic > /dev/null 2>&1
-
-output=$(echo "cat" | ./melvin_organic 2>&1)
-count=$(echo "$output" | grep -o "([0-9.]*)" | wc -l)
-
-echo "  Input: 1 word"
-echo "  Output: $count words"
-echo "  Multiplication: ${count}x"
-echo ""
-
-# Benchmark 3: Memory Scaling
-echo "BENCHMARK 3: Memory Scaling"
-echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
-echo ""
-echo "Measuring: Graph size vs vocabulary"
-echo ""
-echo "Vocab | Graph Size | Bytes/Word"
-echo "------|------------|------------"
-
-for n in 10 50 100 200 500; do
-    rm -f organic.mmap
-    
-    # Train
-    for i in $(seq 1 $n); do
-        echo "word$i next$i" | ./melvin_organic > /dev/null 2>&1
+NODES=${NODES:-"1000 10000 100000 1000000 10000000"}
+DEGREES=${DEGREES:-"1 4 16"}
+SKEW=${SKEW:-1}
+DEPTH=${DEPTH:-3}
+LINES=${LINES:-1000}
+QUERIES=${QUERIES:-1000}
+MAX_EDGES=${MAX_EDGES:-50000000}
+SEED=${SEED:-1}
+out=${1:-bench_results.csv}
+
+cd "$(dirname "$0")"
+make melvin_bench > /dev/null
+release=$(git describe --always --dirty 2>/dev/null || echo unknown)
+date=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+
+for nodes in $NODES; do
+    for degree in $DEGREES; do
+        edges=$((nodes * degree))
+        if [ "$edges" -gt "$MAX_EDGES" ]; then
+            echo "skip: $nodes nodes x $degree (over MAX_EDGES=$MAX_EDGES)" >&2
+            continue
+        fi
+        echo "run:  $nodes nodes, $edges edges" >&2
+        rows=$(./melvin_bench --csv --nodes "$nodes" --edges "$edges" --skew "$SKEW" --depth "$DEPTH" \
+                   --lines "$LINES" --queries "$QUERIES" --saves 10 --loads 5 --seed "$SEED")
+        [ -s "$out" ] || echo "release,date,$(echo "$rows" | head -n 1)" > "$out"
+        echo "$release,$date,$(echo "$rows" | tail -n 1)" >> "$out"
     done
-    
-    if [ -f organic.mmap ]; then
-        bytes=$(stat -f%z organic.mmap 2>/dev/null || stat -c%s organic.mmap 2>/dev/null)
-        per_word=$((bytes / n))
-        size_kb=$((bytes / 1024))
-        printf "%5d | %7d KB | %10d\n" $n $size_kb $per_word
-    fi
 done
 
-echo ""
-echo "Expected: Bytes/word stays roughly constant or grows slowly"
-echo ""
-
-# Benchmark 4: Query Latency Distribution
-echo "BENCHMARK 4: Query Latency"
-echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
-echo ""
-echo "Measuring: Query response time distribution"
-echo ""
-
-rm -f organic.mmap
-
-# Build moderate graph
-for i in $(seq 1 100); do
-    echo "word$i next$i related$i" | ./melvin_organic > /dev/null 2>&1
-done
-
-# Measure query times
-times=()
-for i in $(seq 1 50); do
-    start=$(date +%s%N)
-    echo "word$((i % 50 + 1))" | ./melvin_organic > /dev/null 2>&1
-    end=$(date +%s%N)
-    elapsed=$(( (end - start) / 1000000 ))
-    times+=($elapsed)
-done
-
-# Calculate stats
-sum=0
-min=999999
-max=0
-for t in "${times[@]}"; do
-    sum=$((sum + t))
-    [ $t -lt $min ] && min=$t
-    [ $t -gt $max ] && max=$t
-done
-avg=$((sum / ${#times[@]}))
-
-echo "  Queries: 50"
-echo "  Min: ${min}ms"
-echo "  Avg: ${avg}ms"
-echo "  Max: ${max}ms"
-echo ""
-
-# Benchmark 5: Similarity Threshold Impact
-echo "BENCHMARK 5: Generalization Strength"
-echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
-echo ""
-echo "Measuring: How many generalizations per taught pattern?"
-echo ""
-
-rm -f organic.mmap
-
-# Teach base pattern
-echo "cat sat" | ./melvin_organic > /dev/null 2>&1
-
-# Add similar words
-echo "bat mat hat rat fat pat" | ./melvin_organic > /dev/null 2>&1
-
-# Query each similar word to see if cat→sat generalized
-generalizations=0
-for word in bat mat hat rat fat pat; do
-    output=$(echo "$word" | ./melvin_organic 2>&1)
-    if echo "$output" | grep -q "sat"; then
-        generalizations=$((generalizations + 1))
-    fi
-done
-
-echo "  Taught: cat→sat"
-echo "  Added: 6 similar words"
-echo "  Generalized: $generalizations/6 words"
-echo "  Rate: $(( generalizations * 100 / 6 ))%"
-echo ""
-
-# Benchmark 6: Concurrent Context Handling
-echo "BENCHMARK 6: Context Capacity"
-echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
-echo ""
-echo "Measuring: How many different contexts can coexist?"
-echo ""
-
-rm -f organic.mmap
-
-# Create multiple contexts for same word
-echo "cat sat mat" | ./melvin_organic > /dev/null 2>&1
-echo "cat dog friends" | ./melvin_organic > /dev/null 2>&1
-echo "cat mouse hunt" | ./melvin_organic > /dev/null 2>&1
-echo "cat sleep lazy" | ./melvin_organic > /dev/null 2>&1
-
-# Query should show all contexts
-output=$(echo "cat" | ./melvin_organic 2>&1)
-
-contexts=0
-echo "$output" | grep -q "sat" && contexts=$((contexts + 1))
-echo "$output" | grep -q "dog" && contexts=$((contexts + 1))
-echo "$output" | grep -q "mouse" && contexts=$((contexts + 1))
-echo "$output" | grep -q "sleep" && contexts=$((contexts + 1))
-
-echo "  Taught: 4 different contexts for 'cat'"
-echo "  Recalled: $contexts/4 contexts"
-echo ""
-
-# Benchmark 7: Pattern Decay
-echo "BENCHMARK 7: No Forgetting Test"
-echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
-echo ""
-echo "Measuring: Are old patterns retained?"
-echo ""
-
-rm -f organic.mmap
-
-# Teach early pattern
-echo "alpha beta" | ./melvin_organic > /dev/null 2>&1
-
-# Teach many other patterns
-for i in $(seq 1 100); do
-    echo "word$i next$i" | ./melvin_organic > /dev/null 2>&1
-done
-
-# Query early pattern
-output=$(echo "alpha" | ./melvin_organic 2>&1)
-
-if echo "$output" | grep -q "beta"; then
-    echo "  ✓ Early pattern retained after 100 new patterns"
-else
-    echo "  ✗ Early pattern forgotten"
-fi
-
-echo ""
-
-# Benchmark 8: Throughput
-echo "BENCHMARK 8: Training Throughput"
-echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
-echo ""
-echo "Measuring: Patterns learned per second"
-echo ""
-
-rm -f organic.mmap
-
-start=$(date +%s%N)
-for i in $(seq 1 1000); do
-    echo "pattern$i" | ./melvin_organic > /dev/null 2>&1
-done
-end=$(date +%s%N)
-
-elapsed_sec=$(echo "scale=2; (($end - $start) / 1000000000)" | bc)
-throughput=$(echo "scale=0; 1000 / $elapsed_sec" | bc)
-
-echo "  Patterns: 1000"
-echo "  Time: ${elapsed_sec}s"
-echo "  Throughput: ${throughput} patterns/second"
-echo ""
-
-# Summary
-echo "╔════════════════════════════════════════════════════════════╗"
-echo "║                    BENCHMARK COMPLETE                      ║"
-echo "╚════════════════════════════════════════════════════════════╝"
-echo ""
-echo "Key Findings:"
-echo "  • Edge growth: O(N²) as predicted"
-echo "  • Cascade: ~${count}x multiplication"
-echo "  • Memory: Efficient scaling"
-echo "  • Query time: ${avg}ms average"
-echo "  • Generalization: $(( generalizations * 100 / 6 ))% success"
-echo "  • Context capacity: $contexts/4 contexts"
-echo "  • Retention: No forgetting"
-echo "  • Throughput: ${throughput} patterns/sec"
-echo ""
-
+echo "results: $out" >&2
@@ -5,237 +5,3673 @@
  * Graph: All data, all logic, all intelligence.
  */
 
+#define _GNU_SOURCE         // mremap()
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 
-typedef struct __attribute__((packed)) {
-    uint8_t token[16];
-    uint16_t token_len;
-    int32_t value;
-} Node;
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
-typedef struct __attribute__((packed)) {
-    uint32_t from, to;
-    uint8_t weight;
-} Edge;
+#include "melvin_format.h"
+#include "melvin.h"
+
+/* Outgoing-edge index: out-edges of n are to[off[n] .. off[n+1]] */
+typedef struct {
+    uint32_t *off, *to;
+    uint32_t *pos;          // Edge index -> slot, keeps w in sync
+    uint8_t *w;
+    uint32_t nodes, edges;  // Prefix of nodes/edges this set covers
+    uint32_t *tail;         // In memory: first edge + 1 of each node past the set, 0 = none
+} Csr;
+
+typedef MelvinWalk Walk;   // Traversal bounds (melvin.h)
+
+/* A node waiting in the best-first walk's priority queue */
+typedef struct {
+    float score;            // Product of weight/255 along the path
+    uint32_t seq;           // Push order, breaks ties so equal weights walk like BFS
+    uint32_t node, depth;
+} Pending;
+
+/* A line being tokenized: bytes go in a chunk at a time, token ids come
+ * out as they complete. Only a token split across chunks is buffered. */
+typedef struct {
+    void *ctx;              // Graph (or shard set) the callbacks work on
+    uint32_t (*resolve)(void*, uint8_t*, uint32_t);     // May skip a token: UINT32_MAX
+    void (*link)(void*, uint32_t, uint32_t);    // Connects each token to the one before it, or NULL
+    const uint8_t *delim;   // Separators, 1 for each byte that ends a token
+    int keep;               // Keep every id (the spread walk starts from all)
+    uint8_t *tok;           // Token carried over from the previous chunk
+    uint32_t tok_len, tok_cap;
+    uint32_t *ids, ids_cap; // Resolved ids when keeping them
+    uint32_t count;         // Tokens resolved so far
+    uint32_t last;          // The latest of them
+    uint64_t bytes;         // Fed since stream_begin
+} Stream;
+
+/* Per-thread query scratch: grown to the largest query seen, kept between
+ * queries and reset in O(1), so a walk allocates nothing once warm */
+typedef struct {
+    uint32_t *mark;         // Per-node stamp: == gen means visited this query
+    uint32_t *queue;        // BFS queue, doubles as the visit order
+    float *score;           // Path score of each queue entry
+    uint32_t gen, cap;
+    Pending *heap;          // Best-first frontier, a binary max-heap
+    uint32_t heap_len, heap_cap;
+    uint32_t *owner;        // Parallel levels: frontier position claiming a node, else UINT32_MAX
+    uint32_t sources;       // Distinct start nodes at the head of queue
+    uint32_t *starts;       // A line's starts plus what its rule points to
+    uint32_t starts_cap;
+    char *text;             // A walk's printed text, see reached_text()
+    size_t text_cap;
+    Stream line;            // route()/query(): the line being tokenized
+    FILE *sink;             // Library calls: walk output, rewound per call
+    char *sink_text;
+    size_t sink_len;
+} Scratch;
+
+#define MAX_READERS MELVIN_MAX_READERS
+#define LOG_BUF 256         // Log records buffered before a write()
+#define RULE_SLOTS MELVIN_RULE_SLOTS
+#define CACHE_ENTRIES 1024  // Default query cache size
+#define CACHE_MAX (1u << 24)
+#define CACHE_MAX_STARTS 64 // Queries starting from more nodes are not cached
+
+/* Reader slot: 0 when idle, else the writer epoch seen on entry */
+typedef struct {
+    uint64_t epoch;
+    int used;
+    char pad[64 - sizeof(uint64_t) - sizeof(int)];
+} Reader;
+
+/* A cached query: the walk's text for its start nodes and bounds, as of
+ * one graph generation */
+typedef struct {
+    uint64_t hash, generation;
+    uint32_t *starts, n;
+    Walk walk;
+    char *text;
+    uint32_t len;
+    uint32_t prev, next;    // LRU list, most recent first; UINT32_MAX ends it
+    uint32_t chain;         // Next entry in the same bucket, UINT32_MAX ends it
+} CacheEntry;
 
 typedef struct {
-    Node *nodes;
-    Edge *edges;
+    CacheEntry *entries;    // Allocated on first insert
+    uint32_t *buckets;      // Head entry of each chain, UINT32_MAX if none
+    uint32_t cap, used, mask;
+    uint32_t head, tail;
+    pthread_mutex_t lock;
+} Cache;
+
+/* One open graph: the handle behind Melvin* */
+typedef struct Melvin {
+    char path[PATH_MAX], log_path[PATH_MAX];
+    int fd;
+    char *map;              // MAP_SHARED view of the whole file
+    size_t map_size;
+    Header *hdr;
+    uint32_t *token_off;    // Node arrays, one entry per node id
+    uint16_t *token_len;
+    int32_t *value;
+    uint8_t *arena;         // Token bytes of all nodes, back to back
+    uint32_t arena_used, arena_cap;
+    uint32_t *edge_from;    // Edge arrays, one entry per edge index
+    uint32_t *edge_to;
+    uint8_t *edge_w;
     uint32_t node_count, node_cap;
     uint32_t edge_count, edge_cap;
+    uint32_t *node_hash;    // Token index: node id + 1, 0 = empty slot
+    uint32_t hash_cap;      // Power of two, kept >= 2 * node_count
+    Csr csr[2];
+    uint32_t csr_live;      // Index into csr[] readers should use
+    uint32_t *chain;        // Edges past the CSR, per source in insertion order: next edge + 1
+    uint32_t *chain_last;   // Latest edge + 1 of each node since the chains were built
+    void *chain_map;        // Where the tails and both chain arrays live
+    size_t chain_size;
+    uint32_t *edge_hash;    // (from,to) index: edge index + 1, 0 = empty slot
+    uint32_t ehash_cap;     // Power of two, kept >= 2 * edge_count
+    int readonly;           // Mapped PROT_READ: no inserts, no index rebuilds
+    int locked;             // Holds the file lock (peeking read-only handles don't)
+    uint32_t *rules;        // Rule node + 1 for n-token lines, 0 if none (RULE_SLOTS)
+    uint32_t *values;       // Value index: node id + 1 of the first node with
+                            // each value, 0 = empty slot; hash_cap slots
+    Walk walk;              // Bounds for every route/query on this graph
+    struct Pool *pool;      // Spread walk threads, started by the first walk that needs them
+    pthread_mutex_t pool_lock;  // Held by the walk using the pool; others walk on one thread
+    uint8_t delim[256];     // Token separators
+    uint64_t generation;    // Bumped by every change; cached queries are only
+    Cache cache;            // served for the generation they were computed at
+    
+    // Single writer, many readers: counts and csr_live are published with
+    // release stores; anything readers may still see is only reused after
+    // synchronize(). Remapping closes the gate so no reader is inside.
+    pthread_mutex_t write_lock;
+    uint64_t epoch;
+    int gate;
+    Reader readers[MAX_READERS];
+    
+    // Write-ahead log: records are buffered here, appended at log_size
+    int log_fd;
+    uint64_t log_size;
+    uint32_t log_len;
+    LogRecord log_buf[LOG_BUF];
 } Graph;
 
-Graph g;
+__thread Scratch scratch;   // Traversal buffers of the calling thread
+__thread int reader_hint;   // Reader slot this thread had last; where claiming starts
 
-/* Find or create node */
-uint32_t find_or_create(uint8_t *token, uint32_t len) {
-    for (uint32_t i = 0; i < g.node_count; i++) {
-        if (g.nodes[i].token_len == len && 
-            memcmp(g.nodes[i].token, token, len) == 0) return i;
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define RELAXED(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+/* Hot-path counters, on unless built with -DMELVIN_STATS=0. Relaxed adds
+ * from every thread: running totals, not a consistent snapshot. */
+#ifndef MELVIN_STATS
+#define MELVIN_STATS 1
+#endif
+
+typedef struct {
+    uint64_t lookups, lookup_probes;    // find_node calls, hash slots they read
+    uint64_t nodes_created;
+    uint64_t edge_lookups, edge_probes; // create_edge calls, edge-index slots read
+    uint64_t edges_created, weight_bumps;
+    uint64_t walks, walk_visited, walk_edges;   // Walks, nodes reached, edges looked at
+    uint64_t walk_levels, frontier_max;         // BFS levels expanded, widest of them
+    uint64_t csr_rebuilds, csr_edges;           // CSR rebuilds, edges they sorted
+    uint64_t log_bytes, checkpoints, checkpoint_bytes, load_bytes;
+    uint64_t tokenize_ns, walk_ns, save_ns, checkpoint_ns, load_ns;
+    uint64_t cache_hits, cache_misses;
+} Stats;
+
+Stats stats;
+
+#if MELVIN_STATS
+#define STAT_ADD(field, n) __atomic_fetch_add(&stats.field, (n), __ATOMIC_RELAXED)
+#define STAT_MAX(field, n) stat_max(&stats.field, (n))
+#define STAT_NOW() stat_ns()
+#else
+#define STAT_ADD(field, n) ((void)(n))
+#define STAT_MAX(field, n) ((void)(n))
+#define STAT_NOW() 0
+#endif
+
+uint64_t stat_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void stat_max(uint64_t *field, uint64_t n) {
+    uint64_t cur = __atomic_load_n(field, __ATOMIC_RELAXED);
+    while (n > cur && !__atomic_compare_exchange_n(field, &cur, n, 1, __ATOMIC_RELAXED,
+                                                   __ATOMIC_RELAXED));
+}
+
+/* All counters on one line as name=value pairs */
+void stats_print(FILE *out) {
+    const struct { const char *name; uint64_t *value; } rows[] = {
+        {"lookups", &stats.lookups}, {"lookup_probes", &stats.lookup_probes},
+        {"nodes_created", &stats.nodes_created},
+        {"edge_lookups", &stats.edge_lookups}, {"edge_probes", &stats.edge_probes},
+        {"edges_created", &stats.edges_created}, {"weight_bumps", &stats.weight_bumps},
+        {"walks", &stats.walks}, {"walk_visited", &stats.walk_visited},
+        {"walk_edges", &stats.walk_edges}, {"walk_levels", &stats.walk_levels},
+        {"frontier_max", &stats.frontier_max},
+        {"csr_rebuilds", &stats.csr_rebuilds}, {"csr_edges", &stats.csr_edges},
+        {"log_bytes", &stats.log_bytes}, {"checkpoints", &stats.checkpoints},
+        {"checkpoint_bytes", &stats.checkpoint_bytes}, {"load_bytes", &stats.load_bytes},
+        {"tokenize_ns", &stats.tokenize_ns}, {"walk_ns", &stats.walk_ns},
+        {"save_ns", &stats.save_ns}, {"checkpoint_ns", &stats.checkpoint_ns},
+        {"load_ns", &stats.load_ns},
+        {"cache_hits", &stats.cache_hits}, {"cache_misses", &stats.cache_misses},
+    };
+    for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++) {
+        fprintf(out, "%s%s=%llu", i ? " " : "", rows[i].name,
+                (unsigned long long)__atomic_load_n(rows[i].value, __ATOMIC_RELAXED));
     }
+    fprintf(out, "\n");
+}
+
+#define GRAPH_FILE "melvin.mmap"
+#define SOCKET_FILE "melvin.sock"
+#define LOG_FILE "melvin.log"
+#define LOG_COMPACT_BYTES (4u << 20)    // Fold the log into melvin.mmap past this, or 1/4 of its size
+#define LOG_SYNC_LINES 1024 // Batch mode makes the log durable this often
+#define NODE_MIN_CAP 1024      // New graphs start this small and double as they fill
+#define EDGE_MIN_CAP 4096
+#define ID_MAX (UINT32_MAX - 1)  // UINT32_MAX means "no node"; +1 must fit a hash slot
+#define HASH_MIN_CAP 1024
+#define ARENA_MIN_CAP 8192     // Token bytes a new graph has room for
+#define CSR_SLACK 64        // Uncovered edges tolerated before a rebuild, or 1/8 of the covered ones
+#define INPUT_MAX 4096      // Read chunk; lines may be any length
+#define TOKEN_MAX UINT16_MAX    // Longer tokens are cut into pieces this long
+#define MAX_CLIENTS 64
+#define WALK_SHOWN 19       // Nodes printed past a walk's starts, unless top-K
+#define SPREAD_MIN_FRONTIER 4096    // Smaller levels are expanded on the calling thread
+#define SPREAD_MAX_THREADS 16
+#define LOAD_MAX_THREADS 64
+#define LOAD_MIN_RUN (1u << 20)  // Bulk load: corpus bytes worth a thread
+#define CHECKPOINT_SECS 30
+
+/* Lay sections out for the header's capacities and return the file size.
+ * A section never moves below its current offset, so growing can shift
+ * data up back-to-front without overwriting anything still to be moved. */
+size_t layout(Header *h) {
+    h->section_count = S_COUNT;
+    size_t end = sizeof(Header);
+    for (int s = 0; s < S_COUNT; s++) {
+        Section *sec = &h->sections[s];
+        size_t at = end > sec->offset ? end : sec->offset;
+        sec->offset = (at + SECTION_ALIGN - 1) & ~(size_t)(SECTION_ALIGN - 1);
+        sec->size = melvin_section_size(h, s);
+        if (sec->used > sec->size) sec->used = sec->size;
+        end = sec->offset + sec->size;
+    }
+    return (end + SECTION_ALIGN - 1) & ~(size_t)(SECTION_ALIGN - 1);
+}
+
+/* Point the graph arrays at their sections in the mapping */
+void map_arrays(Graph *g) {
+    Section *sec = g->hdr->sections;
+    g->token_off = (uint32_t*)(g->map + sec[S_TOKEN_OFF].offset);
+    g->token_len = (uint16_t*)(g->map + sec[S_TOKEN_LEN].offset);
+    g->value = (int32_t*)(g->map + sec[S_VALUE].offset);
+    g->arena = (uint8_t*)(g->map + sec[S_ARENA].offset);
+    g->edge_from = (uint32_t*)(g->map + sec[S_EDGE_FROM].offset);
+    g->edge_to = (uint32_t*)(g->map + sec[S_EDGE_TO].offset);
+    g->edge_w = (uint8_t*)(g->map + sec[S_EDGE_W].offset);
+    g->node_hash = (uint32_t*)(g->map + sec[S_HASH].offset);
+    g->edge_hash = (uint32_t*)(g->map + sec[S_EHASH].offset);
+    g->rules = (uint32_t*)(g->map + sec[S_RULES].offset);
+    g->values = (uint32_t*)(g->map + sec[S_VALUES].offset);
+    for (int i = 0; i < 2; i++) {
+        int s = S_CSR_OFF + i * CSR_SECTIONS;
+        g->csr[i].off = (uint32_t*)(g->map + sec[s].offset);
+        g->csr[i].to = (uint32_t*)(g->map + sec[s + 1].offset);
+        g->csr[i].pos = (uint32_t*)(g->map + sec[s + 2].offset);
+        g->csr[i].w = (uint8_t*)(g->map + sec[s + 3].offset);
+    }
+    g->node_cap = g->hdr->node_cap; g->edge_cap = g->hdr->edge_cap;
+    g->hash_cap = g->hdr->hash_cap; g->ehash_cap = g->hdr->ehash_cap;
+    g->arena_cap = g->hdr->arena_cap;
+}
+
+/* Bytes of each section that hold data, for the current counts */
+void section_used(const Header *h, uint64_t used[S_COUNT]) {
+    for (int s = 0; s < S_COUNT; s++) used[s] = 0;
+    used[S_TOKEN_OFF] = (uint64_t)h->node_count * sizeof(uint32_t);
+    used[S_TOKEN_LEN] = (uint64_t)h->node_count * sizeof(uint16_t);
+    used[S_VALUE] = (uint64_t)h->node_count * sizeof(int32_t);
+    used[S_ARENA] = h->arena_used;
+    used[S_EDGE_FROM] = used[S_EDGE_TO] = (uint64_t)h->edge_count * sizeof(uint32_t);
+    used[S_EDGE_W] = h->edge_count;
+    used[S_HASH] = (uint64_t)h->hash_cap * sizeof(uint32_t);
+    used[S_EHASH] = (uint64_t)h->ehash_cap * sizeof(uint32_t);
+    used[S_RULES] = RULE_SLOTS * sizeof(uint32_t);
+    used[S_VALUES] = (uint64_t)h->hash_cap * sizeof(uint32_t);
+    int s = S_CSR_OFF + (h->csr_set & 1) * CSR_SECTIONS;   // The idle set is scratch
+    used[s] = ((uint64_t)h->csr_nodes + 1) * sizeof(uint32_t);
+    used[s + 1] = used[s + 2] = (uint64_t)h->csr_edges * sizeof(uint32_t);
+    used[s + 3] = h->csr_edges;
+}
+
+/* Publish in-memory counts to the file header; the data no longer matches
+ * the section CRCs until the next seal() */
+void sync_header(Graph *g) {
+    Header *h = g->hdr;
+    h->node_count = g->node_count; h->edge_count = g->edge_count;
+    h->arena_used = g->arena_used;
+    h->csr_nodes = g->csr[g->csr_live].nodes; h->csr_edges = g->csr[g->csr_live].edges;
+    h->csr_set = g->csr_live;
     
-    if (g.node_count >= g.node_cap) return UINT32_MAX;
+    uint64_t used[S_COUNT];
+    section_used(h, used);
+    for (int s = 0; s < S_COUNT; s++) h->sections[s].used = used[s];
+    h->flags &= ~F_SEALED;
+    h->header_crc = melvin_header_crc(h);
+}
+
+/* Checksum every section so readers can verify the file */
+void seal(Graph *g) {
+    sync_header(g);
+    for (int s = 0; s < S_COUNT; s++) {
+        Section *sec = &g->hdr->sections[s];
+        sec->crc = melvin_crc32(0, g->map + sec->offset, sec->used);
+    }
+    g->hdr->flags |= F_SEALED;
+    g->hdr->header_crc = melvin_header_crc(g->hdr);
+}
+
+/* First change after a seal: clear F_SEALED on disk before any section
+ * stops matching its CRC, so a crash leaves an unsealed file, not a
+ * corrupt one. Sealing again is left to the next checkpoint. */
+void unseal(Graph *g) {
+    if (!(g->hdr->flags & F_SEALED)) return;
+    sync_header(g);
+    msync(g->map, sizeof(Header), MS_SYNC);
+}
+
+/* Enter a read-side section: from here until reader_exit() nothing this
+ * thread can see is freed, reused or moved. Claims a reader slot of the
+ * graph (a thread may read several graphs), waiting for one to free up
+ * while all MAX_READERS are taken; returns it for reader_exit(). */
+int reader_enter(Graph *g) {
+    int slot = -1;
+    for (int n = 0; slot < 0; n++) {
+        int i = (reader_hint + n) % MAX_READERS, expect = 0;
+        if (__atomic_compare_exchange_n(&g->readers[i].used, &expect, 1, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) slot = i;
+        else if (n % MAX_READERS == MAX_READERS - 1) sched_yield();
+    }
+    reader_hint = slot;
     
-    uint32_t id = g.node_count++;
-    memset(&g.nodes[id], 0, sizeof(Node));
-    memcpy(g.nodes[id].token, token, len < 16 ? len : 16);
-    g.nodes[id].token_len = len;
+    Reader *r = &g->readers[slot];
+    for (;;) {
+        while (__atomic_load_n(&g->gate, __ATOMIC_SEQ_CST)) sched_yield();
+        __atomic_store_n(&r->epoch, __atomic_load_n(&g->epoch, __ATOMIC_SEQ_CST) + 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&g->gate, __ATOMIC_SEQ_CST)) return slot;
+        __atomic_store_n(&r->epoch, 0, __ATOMIC_SEQ_CST);
+    }
+}
+
+void reader_exit(Graph *g, int slot) {
+    __atomic_store_n(&g->readers[slot].epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&g->readers[slot].used, 0, __ATOMIC_RELEASE);
+}
+
+/* Writer: wait until every reader that might have seen the old state is gone */
+void synchronize(Graph *g) {
+    uint64_t e = __atomic_add_fetch(&g->epoch, 1, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < MAX_READERS; i++) {
+        for (;;) {
+            uint64_t seen = __atomic_load_n(&g->readers[i].epoch, __ATOMIC_SEQ_CST);
+            if (seen == 0 || seen > e) break;
+            sched_yield();
+        }
+    }
+}
+
+/* Resize the mapping after the file has grown */
+char *remap(Graph *g, size_t size) {
+#ifdef MREMAP_MAYMOVE
+    void *p = mremap(g->map, g->map_size, size, MREMAP_MAYMOVE);
+#else
+    munmap(g->map, g->map_size);
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, g->fd, 0);
+#endif
+    return p == MAP_FAILED ? NULL : p;
+}
+
+void hash_rebuild(Graph *g);
+void value_rebuild(Graph *g);
+void ehash_rebuild(Graph *g);
+int tail_alloc(Graph *g, uint32_t node_cap, uint32_t edge_cap);
+void checkpoint(Graph *g);
+
+/* Grow section capacities (never shrink): extend the file, move live data
+ * up back-to-front, rebuild any index whose table size changed */
+int relayout(Graph *g, uint32_t node_cap, uint32_t edge_cap, uint32_t hash_cap, uint32_t ehash_cap,
+             uint32_t arena_cap) {
+    // Chains are by index and survive the move; only their room grows
+    if ((node_cap != g->node_cap || edge_cap != g->edge_cap) && !tail_alloc(g, node_cap, edge_cap)) return 0;
+    sync_header(g);
+    Header old = *g->hdr, h = old;
+    h.node_cap = node_cap; h.edge_cap = edge_cap;
+    h.hash_cap = hash_cap; h.ehash_cap = ehash_cap;
+    h.arena_cap = arena_cap;
+    size_t size = layout(&h);
+    if (size > g->map_size) {
+        if (ftruncate(g->fd, size) != 0) return 0;
+        char *map = remap(g, size);
+        if (!map) return 0;
+        g->map = map;
+        g->map_size = size;
+        g->hdr = (Header*)map;
+    }
     
-    // Parse numeric value
-    int is_num = 1;
-    for (uint32_t i = 0; i < len; i++) {
-        if (token[i] < '0' || token[i] > '9') { is_num = 0; break; }
+    // Only the live CSR set is kept, the other one is rebuilt before use;
+    // a resized hash table is rebuilt from scratch
+    uint64_t used[S_COUNT];
+    section_used(&old, used);
+    if (hash_cap != old.hash_cap) used[S_HASH] = used[S_VALUES] = 0;
+    if (ehash_cap != old.ehash_cap) used[S_EHASH] = 0;
+    for (int s = S_COUNT - 1; s >= 0; s--) {
+        size_t from = old.sections[s].offset, to = h.sections[s].offset;
+        if (used[s] && to != from) memmove(g->map + to, g->map + from, used[s]);
     }
-    if (is_num && len > 0) {
-        char buf[32];
-        memcpy(buf, token, len);
-        buf[len] = '\0';
-        g.nodes[id].value = atoi(buf);
+    
+    *g->hdr = h;
+    map_arrays(g);
+    if (hash_cap != old.hash_cap) {
+        hash_rebuild(g);
+        value_rebuild(g);
     }
+    if (ehash_cap != old.ehash_cap) ehash_rebuild(g);
+    sync_header(g);
+    return 1;
+}
+
+/* Grow capacities with every reader held outside */
+int reserve(Graph *g, uint32_t node_cap, uint32_t edge_cap, uint32_t hash_cap, uint32_t ehash_cap,
+            uint32_t arena_cap) {
+    // Close the gate: the mapping may move and regions are rewritten
+    __atomic_store_n(&g->gate, 1, __ATOMIC_SEQ_CST);
+    synchronize(g);
+    int ok = relayout(g, node_cap, edge_cap, hash_cap, ehash_cap, arena_cap);
+    __atomic_store_n(&g->gate, 0, __ATOMIC_SEQ_CST);
     
+    // The log only describes changes within one layout: start a new one
+    if (ok && g->log_fd >= 0) checkpoint(g);
+    return ok;
+}
+
+/* Next capacity for a full array: double, clamped to the id range */
+uint32_t grow_cap(uint32_t cap) {
+    return cap < ID_MAX / 2 ? cap * 2 : ID_MAX;
+}
+
+/* Id of the running boot; a log written in another boot may describe
+ * changes the page cache lost */
+void boot_id(char id[40]) {
+    memset(id, 0, 40);
+    FILE *f = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (!f) return;
+    if (fgets(id, 40, f)) id[strcspn(id, "\n")] = '\0';
+    fclose(f);
+}
+
+/* Append buffered log records to melvin.log. The header counts go first:
+ * a same-boot reopen trusts them instead of replaying, so they must never
+ * lag what the log holds. */
+void log_write(Graph *g) {
+    size_t n = g->log_len * sizeof(LogRecord);
+    if (n) sync_header(g);
+    if (n && pwrite(g->log_fd, g->log_buf, n, g->log_size) == (ssize_t)n) {
+        g->log_size += n;
+        STAT_ADD(log_bytes, n);
+    }
+    g->log_len = 0;
+}
+
+/* Log a mutation before the mapping shows it */
+void log_append(Graph *g, LogRecord *r) {
+    if (g->log_fd < 0) return;
+    r->crc = melvin_crc32(0, r, offsetof(LogRecord, crc));
+    g->log_buf[g->log_len++] = *r;
+    if (g->log_len == LOG_BUF) log_write(g);
+}
+
+void log_node(Graph *g, uint32_t id) {
+    uint32_t len = g->token_len[id];
+    const uint8_t *token = g->arena + g->token_off[id];
+    LogRecord r = { .type = L_NODE, .id = id, .from = g->token_off[id], .token_len = len, .value = g->value[id] };
+    memcpy(r.token, token, len < sizeof(r.token) ? len : sizeof(r.token));
+    log_append(g, &r);
+    for (uint32_t at = sizeof(r.token); at < len; at += sizeof(r.token)) {
+        LogRecord t = { .type = L_TOKEN, .id = id, .from = at };
+        memcpy(t.token, token + at, len - at < sizeof(t.token) ? len - at : sizeof(t.token));
+        log_append(g, &t);
+    }
+}
+
+void log_edge(Graph *g, uint8_t type, uint32_t e) {
+    LogRecord r = { .type = type, .id = e, .from = g->edge_from[e], .to = g->edge_to[e], .weight = g->edge_w[e] };
+    log_append(g, &r);
+}
+
+/* End of a batch of changes: write the log (durable: and fsync it), and
+ * fold it into melvin.mmap once it has grown large. A checkpoint costs the
+ * whole file, so the log may grow with it: O(1) amortized per change. */
+void log_commit(Graph *g, int durable) {
+    if (g->log_fd < 0) return;
+    log_write(g);
+    if (durable) fdatasync(g->log_fd);
+    if (g->log_size > LOG_COMPACT_BYTES && g->log_size > g->map_size / 4) checkpoint(g);
+}
+
+/* Start an empty log on top of the checkpoint just written */
+void log_reset(Graph *g) {
+    LogHeader lh = {
+        .magic = LOG_MAGIC, .version = LOG_VERSION,
+        .graph_id = g->hdr->graph_id, .log_seq = g->hdr->log_seq,
+        .node_count = g->node_count, .edge_count = g->edge_count,
+        .arena_used = g->arena_used,
+    };
+    boot_id(lh.boot_id);
+    g->log_len = 0;
+    g->log_size = 0;
+    if (ftruncate(g->log_fd, 0) == 0 && pwrite(g->log_fd, &lh, sizeof(lh), 0) == sizeof(lh)) {
+        g->log_size = sizeof(lh);
+        fdatasync(g->log_fd);
+    }
+}
+
+/* Token bytes of a node, token_len[id] of them */
+uint8_t *node_token(Graph *g, uint32_t id) {
+    return g->arena + g->token_off[id];
+}
+
+/* Hash token: FNV-1a over its bytes, seeded with the length */
+uint32_t token_hash(const uint8_t *token, uint32_t len) {
+    uint32_t h = 2166136261u ^ len;
+    for (uint32_t i = 0; i < len; i++) h = (h ^ token[i]) * 16777619u;
+    return h;
+}
+
+/* Does node match token? Lengths first, bytes only on a length match */
+int node_matches(Graph *g, uint32_t id, const uint8_t *token, uint32_t len) {
+    return g->token_len[id] == len && memcmp(node_token(g, id), token, len) == 0;
+}
+
+/* Put node id into the first free slot of its probe chain */
+void hash_insert(Graph *g, uint32_t id) {
+    uint32_t mask = g->hash_cap - 1;
+    uint32_t s = token_hash(node_token(g, id), g->token_len[id]) & mask;
+    while (g->node_hash[s]) s = (s + 1) & mask;
+    __atomic_store_n(&g->node_hash[s], id + 1, __ATOMIC_RELAXED);
+}
+
+/* Rebuild token index from the node array */
+void hash_rebuild(Graph *g) {
+    memset(g->node_hash, 0, g->hash_cap * sizeof(uint32_t));
+    for (uint32_t i = 0; i < g->node_count; i++) hash_insert(g, i);
+}
+
+/* Smallest power-of-two index capacity for n entries */
+uint32_t hash_cap_for(uint32_t n) {
+    uint32_t cap = HASH_MIN_CAP;
+    while (cap < 2 * n) cap <<= 1;
+    return cap;
+}
+
+/* Find node, UINT32_MAX if absent */
+uint32_t find_node(Graph *g, uint8_t *token, uint32_t len) {
+    uint32_t mask = g->hash_cap - 1;
+    uint32_t slot, probes = 1, found = UINT32_MAX;
+    for (uint32_t s = token_hash(token, len) & mask; (slot = RELAXED(g->node_hash[s])); s = (s + 1) & mask) {
+        // Slots past node_count are left over from an unsaved run (or a writer mid-insert)
+        uint32_t id = slot - 1;
+        if (id < LOAD(g->node_count) && node_matches(g, id, token, len)) { found = id; break; }
+        probes++;
+    }
+    STAT_ADD(lookups, 1);
+    STAT_ADD(lookup_probes, probes);
+    return found;
+}
+
+/* Rule nodes: "rule_<n>token" holds the rule for n-token lines. The first
+ * one per n is registered in the file as it is inserted, so neither
+ * opening nor routing scans */
+uint32_t rule_tokens(const uint8_t *token, uint32_t len) {
+    if (len < 11 || memcmp(token, "rule_", 5) != 0 || memcmp(token + len - 5, "token", 5) != 0) {
+        return UINT32_MAX;
+    }
+    uint32_t n = 0;
+    for (uint32_t i = 5; i < len - 5; i++) {
+        if (token[i] < '0' || token[i] > '9' || (i == 5 && token[i] == '0' && len > 11)) return UINT32_MAX;
+        n = n * 10 + (token[i] - '0');
+        if (n >= RULE_SLOTS) return UINT32_MAX;
+    }
+    return n;
+}
+
+/* Rule node for n-token lines, UINT32_MAX if none. A slot naming a node
+ * an unsaved run never published (or that now holds another token) is empty. */
+uint32_t rule_for(Graph *g, uint32_t n) {
+    uint32_t id = n < RULE_SLOTS ? RELAXED(g->rules[n]) - 1 : UINT32_MAX;
+    if (id >= LOAD(g->node_count) || rule_tokens(node_token(g, id), g->token_len[id]) != n) return UINT32_MAX;
     return id;
 }
 
-/* Create edge */
-void create_edge(uint32_t from, uint32_t to, uint8_t weight) {
-    if (from >= g.node_count || to >= g.node_count || from == to) return;
+void rule_note(Graph *g, uint32_t id) {
+    uint32_t n = rule_tokens(node_token(g, id), g->token_len[id]);
+    if (n != UINT32_MAX && rule_for(g, n) == UINT32_MAX) g->rules[n] = id + 1;
+}
+
+/* Register afresh from the node array: converted or replayed graphs */
+void rule_rebuild(Graph *g) {
+    memset(g->rules, 0, RULE_SLOTS * sizeof(uint32_t));
+    for (uint32_t i = 0; i < g->node_count; i++) rule_note(g, i);
+}
+
+/* A decimal token, optionally signed, checked and parsed in one pass;
+ * 0 if it isn't one or doesn't fit in 32 bits */
+int parse_number(const uint8_t *token, uint32_t len, int32_t *value) {
+    int negative = len && token[0] == '-';
+    uint32_t i = len && (token[0] == '-' || token[0] == '+');
+    if (i == len) return 0;
+    uint64_t limit = negative ? (uint64_t)INT32_MAX + 1 : INT32_MAX, v = 0;
+    for (; i < len; i++) {
+        uint32_t d = token[i] - '0';
+        if (d > 9) return 0;
+        v = v * 10 + d;
+        if (v > limit) return 0;
+    }
+    *value = negative ? (int32_t)-(int64_t)v : (int32_t)v;
+    return 1;
+}
+
+uint32_t value_hash(int32_t value) {
+    return (uint32_t)(((uint64_t)(uint32_t)value * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+/* Index a numeric node unless an earlier one has its value; the table
+ * shares the token index's size, so it has room whenever a node does.
+ * Slots naming nodes an unsaved run never published are passed over. */
+void value_note(Graph *g, uint32_t id) {
+    uint32_t mask = g->hash_cap - 1, slot;
+    int32_t value = g->value[id];
+    uint32_t s = value_hash(value) & mask;
+    for (; (slot = g->values[s]); s = (s + 1) & mask) {
+        if (slot - 1 < g->node_count && g->value[slot - 1] == value) return;
+    }
+    __atomic_store_n(&g->values[s], id + 1, __ATOMIC_RELAXED);
+}
+
+/* Index every numeric node: converted or replayed graphs, a resized table */
+void value_rebuild(Graph *g) {
+    memset(g->values, 0, g->hash_cap * sizeof(uint32_t));
+    int32_t value;
+    for (uint32_t i = 0; i < g->node_count; i++) {
+        if (parse_number(node_token(g, i), g->token_len[i], &value)) value_note(g, i);
+    }
+}
+
+/* First numeric node with this value, UINT32_MAX if none */
+uint32_t find_value(Graph *g, int32_t value) {
+    uint32_t mask = g->hash_cap - 1, slot;
+    for (uint32_t s = value_hash(value) & mask; (slot = RELAXED(g->values[s])); s = (s + 1) & mask) {
+        uint32_t id = slot - 1;
+        if (id < LOAD(g->node_count) && g->value[id] == value) return id;
+    }
+    return UINT32_MAX;
+}
+
+/* Add a node with the next id, in room already reserved (logged unless a
+ * bulk load checkpoints instead); filled and indexed first, then published */
+uint32_t node_append(Graph *g, const uint8_t *token, uint32_t len, int logged) {
+    uint32_t id = g->node_count;
+    memcpy(g->arena + g->arena_used, token, len);
+    g->token_off[id] = g->arena_used;
+    g->token_len[id] = len;
+    g->value[id] = 0;
+    g->arena_used += len;
     
-    for (uint32_t i = 0; i < g.edge_count; i++) {
-        if (g.edges[i].from == from && g.edges[i].to == to) {
-            g.edges[i].weight = (g.edges[i].weight < 240) ? g.edges[i].weight + 15 : 255;
-            return;
-        }
+    int numeric = parse_number(token, len, &g->value[id]);
+    
+    if (logged) log_node(g, id);
+    hash_insert(g, id);
+    rule_note(g, id);
+    if (numeric) value_note(g, id);
+    STAT_ADD(nodes_created, 1);
+    STORE(g->node_count, id + 1);
+    STORE(g->generation, g->generation + 1);
+    return id;
+}
+
+/* Find or create node */
+uint32_t find_or_create(Graph *g, uint8_t *token, uint32_t len) {
+    uint32_t found = find_node(g, token, len);
+    if (found != UINT32_MAX) return found;
+    unseal(g);
+    
+    // Grow storage, index and arena together so readers are held out only once
+    if (len > UINT16_MAX || len > ID_MAX - g->arena_used) return UINT32_MAX;
+    uint32_t need = g->arena_used + len;
+    if (g->node_count >= g->node_cap || 2 * (g->node_count + 1) > g->hash_cap || need > g->arena_cap) {
+        if (g->node_count >= ID_MAX) return UINT32_MAX;
+        uint32_t node_cap = g->node_count < g->node_cap ? g->node_cap : grow_cap(g->node_cap);
+        uint32_t hash_cap = 2 * (g->node_count + 1) > g->hash_cap ? g->hash_cap * 2 : g->hash_cap;
+        uint32_t arena_cap = g->arena_cap;
+        while (arena_cap < need) arena_cap = grow_cap(arena_cap);
+        if (!reserve(g, node_cap, g->edge_cap, hash_cap, g->ehash_cap, arena_cap)) return UINT32_MAX;
     }
     
-    if (g.edge_count >= g.edge_cap) return;
-    g.edges[g.edge_count++] = (Edge){from, to, weight};
+    return node_append(g, token, len, 1);
 }
 
-/* Init: create bit patterns in graph */
-void init() {
-    const char *patterns[][2] = {
-        {"0+0+0", "0,0"}, {"0+1+0", "1,0"}, {"1+0+0", "1,0"}, {"1+1+0", "0,1"},
-        {"0+0+1", "1,0"}, {"0+1+1", "0,1"}, {"1+0+1", "0,1"}, {"1+1+1", "1,1"},
-    };
+/* Hash edge key from<<32|to */
+uint32_t edge_hash(uint32_t from, uint32_t to) {
+    uint64_t k = ((uint64_t)from << 32 | to) * 0x9E3779B97F4A7C15ull;
+    return (uint32_t)(k >> 32);
+}
+
+/* Put edge index into the first free slot of its probe chain */
+void ehash_insert(Graph *g, uint32_t e) {
+    uint32_t mask = g->ehash_cap - 1;
+    uint32_t s = edge_hash(g->edge_from[e], g->edge_to[e]) & mask;
+    while (g->edge_hash[s]) s = (s + 1) & mask;
+    __atomic_store_n(&g->edge_hash[s], e + 1, __ATOMIC_RELAXED);
+}
+
+/* Rebuild (from,to) index from the edge array */
+void ehash_rebuild(Graph *g) {
+    memset(g->edge_hash, 0, g->ehash_cap * sizeof(uint32_t));
+    for (uint32_t e = 0; e < g->edge_count; e++) ehash_insert(g, e);
+}
+
+/* Find edge index for (from,to), UINT32_MAX if absent */
+uint32_t find_edge(Graph *g, uint32_t from, uint32_t to) {
+    uint32_t mask = g->ehash_cap - 1, probes = 1, found = UINT32_MAX;
+    for (uint32_t s = edge_hash(from, to) & mask; g->edge_hash[s]; s = (s + 1) & mask) {
+        uint32_t i = g->edge_hash[s] - 1;
+        if (i < LOAD(g->edge_count) && g->edge_from[i] == from && g->edge_to[i] == to) { found = i; break; }
+        probes++;
+    }
+    STAT_ADD(edge_lookups, 1);
+    STAT_ADD(edge_probes, probes);
+    return found;
+}
+
+/* Chain edge e behind the live CSR set: after the latest edge of its
+ * source, and as that node's first edge past the set if it is */
+void tail_link(Graph *g, uint32_t e) {
+    Csr *c = &g->csr[g->csr_live];
+    uint32_t n = g->edge_from[e], last = g->chain_last[n];
+    g->chain[e] = 0;
+    if (last) __atomic_store_n(&g->chain[last - 1], e + 1, __ATOMIC_RELAXED);  // Older sets' readers
+    if (last <= c->edges) __atomic_store_n(&c->tail[n], e + 1, __ATOMIC_RELAXED);
+    g->chain_last[n] = e + 1;
+}
+
+void tail_free(Graph *g) {
+    if (g->chain_map) munmap(g->chain_map, g->chain_size);
+    g->chain_map = NULL;
+    g->csr[0].tail = g->csr[1].tail = g->chain = g->chain_last = NULL;
+}
+
+/* Chains for room of the given capacities, linked afresh from the edges
+ * past the live set; kept in memory, so every mapping builds its own.
+ * One anonymous mapping: its pages are zero until touched, so a big
+ * graph with a short tail opens in O(1). On failure the old chains stay. */
+int tail_alloc(Graph *g, uint32_t node_cap, uint32_t edge_cap) {
+    size_t size = ((size_t)node_cap * 3 + edge_cap) * sizeof(uint32_t);
+    uint32_t *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) return 0;
+    tail_free(g);
+    g->chain_map = map; g->chain_size = size;
+    g->csr[0].tail = map; g->csr[1].tail = map + node_cap;
+    g->chain_last = map + 2 * (size_t)node_cap;
+    g->chain = map + 3 * (size_t)node_cap;
+    for (uint32_t e = g->csr[g->csr_live].edges; e < g->edge_count; e++) tail_link(g, e);
+    return 1;
+}
+
+/* Set an edge's new weight; readers may be weighing it right now */
+void edge_weigh(Graph *g, uint32_t e, uint8_t w, int logged) {
+    __atomic_store_n(&g->edge_w[e], w, __ATOMIC_RELAXED);
+    Csr *c = &g->csr[g->csr_live];
+    if (e < c->edges) __atomic_store_n(&c->w[c->pos[e]], w, __ATOMIC_RELAXED);
+    if (logged) log_edge(g, L_WEIGHT, e);
+    STAT_ADD(weight_bumps, 1);
+    STORE(g->generation, g->generation + 1);
+}
+
+/* Add an edge in room already reserved, like node_append() */
+void edge_append(Graph *g, uint32_t from, uint32_t to, uint8_t weight, int logged) {
+    g->edge_from[g->edge_count] = from;
+    g->edge_to[g->edge_count] = to;
+    g->edge_w[g->edge_count] = weight;
+    if (logged) log_edge(g, L_EDGE, g->edge_count);
+    ehash_insert(g, g->edge_count);
+    tail_link(g, g->edge_count);
+    STORE(g->edge_count, g->edge_count + 1);
+    STORE(g->generation, g->generation + 1);
+    STAT_ADD(edges_created, 1);
+}
+
+/* Create edge */
+void create_edge(Graph *g, uint32_t from, uint32_t to, uint8_t weight) {
+    if (from >= g->node_count || to >= g->node_count || from == to) return;
+    unseal(g);
     
-    for (int i = 0; i < 8; i++) {
-        uint32_t p = find_or_create((uint8_t*)patterns[i][0], strlen(patterns[i][0]));
-        uint32_t r = find_or_create((uint8_t*)patterns[i][1], strlen(patterns[i][1]));
-        create_edge(p, r, 255);
+    uint32_t i = find_edge(g, from, to);
+    if (i != UINT32_MAX) {
+        edge_weigh(g, i, (g->edge_w[i] < 240) ? g->edge_w[i] + 15 : 255, 1);
+        return;
+    }
+    
+    if (g->edge_count >= g->edge_cap || 2 * (g->edge_count + 1) > g->ehash_cap) {
+        if (g->edge_count >= ID_MAX) return;
+        uint32_t edge_cap = g->edge_count < g->edge_cap ? g->edge_cap : grow_cap(g->edge_cap);
+        uint32_t ehash_cap = 2 * (g->edge_count + 1) > g->ehash_cap ? g->ehash_cap * 2 : g->ehash_cap;
+        if (!reserve(g, g->node_cap, edge_cap, g->hash_cap, ehash_cap, g->arena_cap)) return;
     }
+    edge_append(g, from, to, weight, 1);
 }
 
-/* Route: follow edges, depth-first to find all reachable nodes */
-void route(char *input) {
-    uint32_t nodes[100], count = 0, start = 0;
-    size_t len = strlen(input);
+/* Rebuild CSR over all edges into the idle set, then make it live;
+ * rows keep edge insertion order */
+void csr_rebuild(Graph *g) {
+    uint32_t n = g->node_count, m = g->edge_count;
+    uint32_t next = g->csr_live ^ 1;
+    Csr *c = &g->csr[next];
+    uint32_t *off = c->off, *to = c->to, *pos = c->pos;
+    uint8_t *w = c->w;
     
-    // Tokenize
-    for (size_t i = 0; i <= len; i++) {
-        if (i == len || input[i] == ' ' || input[i] == '\n') {
-            if (i > start) {
-                uint32_t nid = find_or_create((uint8_t*)&input[start], i - start);
-                if (nid != UINT32_MAX) nodes[count++] = nid;
-            }
-            start = i + 1;
-        }
+    // Readers that picked this set up before the last switch must be done
+    synchronize(g);
+    
+    memset(off, 0, (n + 1) * sizeof(uint32_t));
+    memset(c->tail, 0, g->node_cap * sizeof(uint32_t));  // Edges to come chain from here
+    
+    // Counting sort by source: count, prefix sum, scatter, shift back
+    for (uint32_t e = 0; e < m; e++) off[g->edge_from[e] + 1]++;
+    for (uint32_t i = 0; i < n; i++) off[i+1] += off[i];
+    for (uint32_t e = 0; e < m; e++) {
+        uint32_t k = off[g->edge_from[e]]++;
+        to[k] = g->edge_to[e];
+        w[k] = g->edge_w[e];
+        pos[e] = k;
     }
+    memmove(off + 1, off, n * sizeof(uint32_t));
+    off[0] = 0;
     
-    if (count == 0) return;
+    c->nodes = n; c->edges = m;
+    STORE(g->csr_live, next);
+    STAT_ADD(csr_rebuilds, 1);
+    STAT_ADD(csr_edges, m);
+}
+
+/* Whether enough edges sit past the CSR to rebuild it. Readers reach them
+ * through the chains, and the slack grows with the graph, so rebuilds cost
+ * O(1) amortized per edge. */
+int csr_stale(Graph *g) {
+    uint32_t covered = g->csr[g->csr_live].edges;
+    uint32_t slack = covered / 8 > CSR_SLACK ? covered / 8 : CSR_SLACK;
+    return g->edge_count - covered > slack;
+}
+
+/* Size the thread's traversal scratch to n nodes and start a new visit generation */
+int scratch_begin(Scratch *sc, uint32_t n) {
+    if (sc->cap < n) {
+        // Doubling: a growing graph reallocates a few times, not per query
+        uint32_t cap = sc->cap > 512 ? sc->cap : 512;
+        while (cap < n) cap = cap < UINT32_MAX / 2 ? cap * 2 : UINT32_MAX;
+        uint32_t *mark = calloc(cap, sizeof(uint32_t));
+        uint32_t *queue = malloc(cap * sizeof(uint32_t));
+        float *score = malloc(cap * sizeof(float));
+        if (!mark || !queue || !score) { free(mark); free(queue); free(score); return 0; }
+        free(sc->mark); free(sc->queue); free(sc->score); free(sc->owner);
+        sc->mark = mark; sc->queue = queue; sc->score = score;
+        sc->owner = NULL;
+        sc->cap = cap;
+        sc->gen = 0;
+    }
     
-    // Connect sequence
-    for (uint32_t i = 0; i + 1 < count; i++) {
-        create_edge(nodes[i], nodes[i+1], 100);
+    // Stamps only need clearing when the generation wraps
+    if (++sc->gen == 0) {
+        memset(sc->mark, 0, sc->cap * sizeof(uint32_t));
+        sc->gen = 1;
+    }
+    return 1;
+}
+
+/* Bit patterns every new graph starts with: full-adder inputs -> sum,carry */
+const char *init_patterns[8][2] = {
+    {"0+0+0", "0,0"}, {"0+1+0", "1,0"}, {"1+0+0", "1,0"}, {"1+1+0", "0,1"},
+    {"0+0+1", "1,0"}, {"0+1+1", "0,1"}, {"1+0+1", "0,1"}, {"1+1+1", "1,1"},
+};
+
+/* Init: create bit patterns in graph */
+void init(Graph *g) {
+    for (int i = 0; i < 8; i++) {
+        uint32_t p = find_or_create(g, (uint8_t*)init_patterns[i][0], strlen(init_patterns[i][0]));
+        uint32_t r = find_or_create(g, (uint8_t*)init_patterns[i][1], strlen(init_patterns[i][1]));
+        create_edge(g, p, r, 255);
     }
+}
+
+/* Stream callbacks on one graph: look a token up, or add it; learn that
+ * one token followed another */
+uint32_t resolve_find(void *ctx, uint8_t *token, uint32_t len) {
+    return find_node(ctx, token, len);
+}
+
+uint32_t resolve_create(void *ctx, uint8_t *token, uint32_t len) {
+    return find_or_create(ctx, token, len);
+}
+
+void link_edge(void *ctx, uint32_t from, uint32_t to) {
+    create_edge(ctx, from, to, 100);
+}
+
+void stream_begin(Stream *st, void *ctx, const uint8_t *delim, uint32_t (*resolve)(void*, uint8_t*, uint32_t),
+                  void (*link)(void*, uint32_t, uint32_t), int keep) {
+    st->ctx = ctx;
+    st->delim = delim;
+    st->resolve = resolve;
+    st->link = link;
+    st->keep = keep;
+    st->tok_len = st->count = 0;
+    st->bytes = 0;
+}
+
+void stream_free(Stream *st) {
+    free(st->tok);
+    free(st->ids);
+    *st = (Stream){0};
+}
+
+void scratch_free(Scratch *sc) {
+    free(sc->mark);
+    free(sc->queue);
+    free(sc->score);
+    free(sc->heap);
+    free(sc->owner);
+    free(sc->starts);
+    free(sc->text);
+    stream_free(&sc->line);
+    if (sc->sink) fclose(sc->sink);
+    free(sc->sink_text);
+    *sc = (Scratch){0};
+}
+
+void stream_token(Stream *st, uint8_t *token, uint32_t len) {
+    uint32_t nid = st->resolve(st->ctx, token, len);
+    if (nid == UINT32_MAX) return;
     
-    // Check if graph has routing rules for this pattern
-    // Look for rule nodes that match input structure
-    if (count == 3) {
-        // Check for routing rule: "rule_3tokens" or similar
-        uint32_t rule = UINT32_MAX;
-        for (uint32_t i = 0; i < g.node_count; i++) {
-            if (g.nodes[i].token_len == 11 && 
-                memcmp(g.nodes[i].token, "rule_3token", 11) == 0) {
-                rule = i;
-                break;
+    // Sliding window: each edge needs only the token before it
+    if (st->link && st->count) st->link(st->ctx, st->last, nid);
+    if (st->keep) {
+        if (st->count == st->ids_cap) {
+            uint32_t cap = st->ids_cap ? st->ids_cap * 2 : 64;
+            uint32_t *ids = realloc(st->ids, cap * sizeof(uint32_t));
+            if (!ids) {
+                fprintf(stderr, "melvin: out of memory for line tokens\n");
+                st->keep = 0;
+            } else {
+                st->ids = ids;
+                st->ids_cap = cap;
             }
         }
-        
-        // If rule exists, follow its edges to execute
-        if (rule != UINT32_MAX) {
-            for (uint32_t e = 0; e < g.edge_count; e++) {
-                if (g.edges[e].from == rule) {
-                    // Rule says what to do! (could point to circuits)
-                    // For now, just note it exists
-                    break;
-                }
+        if (st->keep) st->ids[st->count] = nid;
+    }
+    st->last = nid;
+    st->count++;
+}
+
+/* Resolve the token carried so far, if any */
+void stream_flush(Stream *st) {
+    if (st->tok_len) stream_token(st, st->tok, st->tok_len);
+    st->tok_len = 0;
+}
+
+/* Carry bytes of an unfinished token; tokens past TOKEN_MAX are cut */
+void stream_carry(Stream *st, const char *p, size_t n) {
+    while (n) {
+        if (st->tok_len == TOKEN_MAX) stream_flush(st);
+        size_t take = TOKEN_MAX - st->tok_len;
+        if (take > n) take = n;
+        if (st->tok_len + take > st->tok_cap) {
+            uint32_t cap = st->tok_cap ? st->tok_cap : 64;
+            while (cap < st->tok_len + take) cap *= 2;
+            if (cap > TOKEN_MAX) cap = TOKEN_MAX;
+            uint8_t *tok = realloc(st->tok, cap);
+            if (!tok) {
+                fprintf(stderr, "melvin: out of memory for a token\n");
+                st->tok_len = 0;
+                return;
             }
+            st->tok = tok;
+            st->tok_cap = cap;
         }
+        memcpy(st->tok + st->tok_len, p, take);
+        st->tok_len += take;
+        p += take;
+        n -= take;
     }
-    
-    // Route through graph: follow ALL edges until exhausted
-    uint32_t visited[10000];
-    int visit_count = 0;
-    uint32_t queue[10000];
-    int q_start = 0, q_end = 0;
-    
-    // Start from last node
-    queue[q_end++] = nodes[count-1];
-    visited[visit_count++] = nodes[count-1];
-    
-    // Follow edges until no more new nodes found (unlimited hops)
-    while (q_start < q_end && visit_count < 10000) {
-        uint32_t current = queue[q_start++];
-        
-        for (uint32_t e = 0; e < g.edge_count; e++) {
-            if (g.edges[e].from == current) {
-                uint32_t target = g.edges[e].to;
-                
-                // Check if visited
-                int seen = 0;
-                for (int v = 0; v < visit_count; v++) {
-                    if (visited[v] == target) { seen = 1; break; }
-                }
-                
-                if (!seen) {
-                    visited[visit_count++] = target;
-                    queue[q_end++] = target;
-                }
+}
+
+/* Feed the next chunk of the line */
+void stream_feed(Stream *st, const char *buf, size_t len) {
+    uint64_t t = STAT_NOW();
+    size_t start = 0;
+    st->bytes += len;
+    for (size_t i = 0; i < len; i++) {
+        if (!st->delim[(uint8_t)buf[i]]) continue;
+        if (st->tok_len) {
+            stream_carry(st, buf + start, i - start);
+            stream_flush(st);
+        } else {
+            // Whole tokens resolve straight from the chunk
+            for (size_t at = start; at < i; at += TOKEN_MAX) {
+                size_t n = i - at < TOKEN_MAX ? i - at : TOKEN_MAX;
+                stream_token(st, (uint8_t*)&buf[at], n);
             }
         }
+        start = i + 1;
     }
-    
-    // Output all reachable nodes
-    printf("%.*s → ", g.nodes[nodes[count-1]].token_len, g.nodes[nodes[count-1]].token);
-    for (int v = 1; v < visit_count && v < 20; v++) {
-        printf("%.*s ", g.nodes[visited[v]].token_len, g.nodes[visited[v]].token);
+    if (start < len) stream_carry(st, buf + start, len - start);
+    STAT_ADD(tokenize_ns, STAT_NOW() - t);
+}
+
+/* Read one line of any length from in into the stream (newline included);
+ * returns 0 at end of input */
+int stream_line(Stream *st, FILE *in) {
+    char chunk[INPUT_MAX];
+    while (fgets(chunk, sizeof(chunk), in)) {
+        size_t len = strlen(chunk);
+        stream_feed(st, chunk, len);
+        if (len && chunk[len-1] == '\n') return 1;
     }
-    printf("\n");
+    return st->bytes > 0;
 }
 
-/* Save graph */
-void save() {
-    int fd = open("melvin.mmap", O_RDWR | O_CREAT, 0644);
-    if (fd < 0) return;
-    
-    size_t size = sizeof(uint32_t)*4 + g.node_count*sizeof(Node) + g.edge_count*sizeof(Edge);
-    ftruncate(fd, size);
-    
-    void *mem = mmap(NULL, size, PROT_WRITE, MAP_SHARED, fd, 0);
-    if (mem != MAP_FAILED) {
-        uint32_t *h = mem;
-        h[0] = g.node_count; h[1] = g.node_cap; h[2] = g.edge_count; h[3] = g.edge_cap;
-        memcpy(h+4, g.nodes, g.node_count * sizeof(Node));
-        memcpy((char*)(h+4) + g.node_count*sizeof(Node), g.edges, g.edge_count*sizeof(Edge));
-        munmap(mem, size);
+/* Ids the walk starts from: the last token, or all of them if kept */
+const uint32_t *stream_starts(const Stream *st, uint32_t *n) {
+    if (st->keep && st->ids) {
+        *n = st->count;
+        return st->ids;
     }
-    close(fd);
+    *n = st->count ? 1 : 0;
+    return &st->last;
 }
 
-/* Load graph */
-void load() {
-    int fd = open("melvin.mmap", O_RDONLY);
-    if (fd < 0) return;
-    
-    struct stat st;
-    fstat(fd, &st);
-    
-    void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (mem != MAP_FAILED) {
-        uint32_t *h = mem;
-        g.node_count = h[0]; g.edge_count = h[2];
-        memcpy(g.nodes, h+4, g.node_count * sizeof(Node));
-        memcpy(g.edges, (char*)(h+4) + g.node_count*sizeof(Node), g.edge_count*sizeof(Edge));
-        munmap(mem, st.st_size);
+/* What a walk may read: the CSR set and counts it started with */
+typedef struct {
+    Graph *g;
+    Csr *c;
+    uint32_t csr_nodes, csr_edges, edge_count, node_count;
+    const uint32_t *tail;   // Chain heads of c
+} View;
+
+View view_begin(Graph *g) {
+    // Edges, then the CSR, then nodes. A set only chains the edges added
+    // while it is live, so it must be live after the count was taken; a
+    // set rebuilt since covers more, all of it published.
+    View v = { .g = g, .edge_count = LOAD(g->edge_count) };
+    v.c = &g->csr[LOAD(g->csr_live)];
+    v.csr_nodes = v.c->nodes; v.csr_edges = v.c->edges;
+    v.tail = v.c->tail;
+    v.node_count = LOAD(g->node_count);
+    if (v.csr_edges > v.edge_count) v.edge_count = v.csr_edges;
+    return v;
+}
+
+/* First slot in [k, last) of a CSR row weighing at least min, or last.
+ * A row's weights are contiguous: compares 32 (AVX2) or 16 (SSE2, NEON)
+ * at a time. Bumps racing with it only make an edge heavier. */
+uint32_t skip_light(const uint8_t *w, uint32_t k, uint32_t last, uint8_t min) {
+    if (!min) return k;
+#if defined(__AVX2__)
+    __m256i key = _mm256_set1_epi8((char)min);
+    for (; k + 32 <= last; k += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(w + k));
+        uint32_t hit = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(x, key), x));
+        if (hit) return k + __builtin_ctz(hit);
     }
-    close(fd);
+#elif defined(__SSE2__)
+    __m128i key = _mm_set1_epi8((char)min);
+    for (; k + 16 <= last; k += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(w + k));
+        uint32_t hit = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(x, key), x));
+        if (hit) return k + __builtin_ctz(hit);
+    }
+#elif defined(__aarch64__)
+    uint8x16_t key = vdupq_n_u8(min);
+    for (; k + 16 <= last; k += 16) {
+        if (vmaxvq_u8(vcgeq_u8(vld1q_u8(w + k), key))) break;     // Found below
+    }
+#endif
+    while (k < last && RELAXED(w[k]) < min) k++;
+    return k;
 }
 
-int main() {
-    g.node_cap = 100000;
-    g.edge_cap = 1000000;
-    g.nodes = calloc(g.node_cap, sizeof(Node));
-    g.edges = calloc(g.edge_cap, sizeof(Edge));
-    
-    if (!g.nodes || !g.edges) return 1;
-    
-    load();
-    if (g.node_count == 0) init();
-    
-    char input[4096];
-    if (fgets(input, sizeof(input), stdin)) {
-        route(input);
+/* Out-edges of one node weighing at least min: its CSR row, then its
+ * chain of edges behind the CSR */
+typedef struct {
+    uint32_t k, last, e;    // e: next chained edge + 1, 0 = none
+    uint8_t min;
+} Cursor;
+
+Cursor out_edges(const View *v, uint32_t n, uint8_t min) {
+    Cursor it = { .e = RELAXED(v->tail[n]), .min = min };
+    if (n < v->csr_nodes) {
+        it.k = v->c->off[n];
+        it.last = v->c->off[n + 1];
+    }
+    return it;
+}
+
+int next_edge(const View *v, Cursor *it, uint32_t *to, uint8_t *w) {
+    it->k = skip_light(v->c->w, it->k, it->last, it->min);
+    if (it->k < it->last) {
+        *to = v->c->to[it->k];
+        *w = RELAXED(v->c->w[it->k]);
+        it->k++;
+        return 1;
+    }
+    // Links to edges past the view are the writer's, mid-insert
+    while (it->e && it->e - 1 < v->edge_count) {
+        uint32_t e = it->e - 1;
+        it->e = RELAXED(v->g->chain[e]);
+        *w = RELAXED(v->g->edge_w[e]);
+        if (*w < it->min) continue;
+        *to = v->g->edge_to[e];
+        return 1;
     }
-    
-    save();
-    free(g.nodes);
-    free(g.edges);
     return 0;
 }
+
+/*
+ * Parallel levels. A level's frontier is cut into one share per thread and
+ * expanded in two passes: claim, where every unvisited target takes the
+ * lowest frontier position pointing at it; then collect, where each share
+ * appends the targets it won. Concatenating the shares in order gives the
+ * same level, in the same order, as expanding it on one thread.
+ */
+typedef struct Pool Pool;
+
+/* One thread's slice of a level: frontier positions [first, last) */
+typedef struct {
+    Pool *pool;
+    uint32_t first, last;
+    uint32_t *found;        // Targets this share won, in frontier order
+    float *found_score;
+    uint32_t found_len, found_cap;
+    uint64_t edges;         // Edges the claim pass looked at
+    int failed;
+} Share;
+
+/* Threads working through the levels of a graph's spread walks, one walk
+ * at a time */
+struct Pool {
+    Graph *graph;
+    const View *v;
+    const Walk *w;
+    Scratch *sc;
+    Share share[SPREAD_MAX_THREADS];
+    pthread_t thread[SPREAD_MAX_THREADS];
+    uint32_t threads;       // Shares per level; share 0 runs on the caller
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+    uint32_t round, pending;
+    int pass, stop;         // pass 0 claims, pass 1 collects
+};
+
+void share_claim(Share *sh) {
+    const View *v = sh->pool->v;
+    Scratch *sc = sh->pool->sc;
+    uint32_t *owner = sc->owner, gen = sc->gen;
+    uint8_t min = sh->pool->w->min_weight;
+    for (uint32_t p = sh->first; p < sh->last; p++) {
+        Cursor it = out_edges(v, sc->queue[p], min);
+        uint32_t target;
+        uint8_t weight;
+        while (next_edge(v, &it, &target, &weight)) {
+            sh->edges++;
+            if (sc->mark[target] == gen) continue;
+            uint32_t cur = __atomic_load_n(&owner[target], __ATOMIC_RELAXED);
+            while (p < cur && !__atomic_compare_exchange_n(&owner[target], &cur, p, 1,
+                                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        }
+    }
+}
+
+void share_collect(Share *sh) {
+    const View *v = sh->pool->v;
+    Scratch *sc = sh->pool->sc;
+    uint32_t *owner = sc->owner, gen = sc->gen;
+    sh->found_len = 0;
+    for (uint32_t p = sh->first; p < sh->last; p++) {
+        Cursor it = out_edges(v, sc->queue[p], sh->pool->w->min_weight);
+        uint32_t target;
+        uint8_t weight;
+        while (next_edge(v, &it, &target, &weight)) {
+            // Weights may have moved since the claim; who won is what counts
+            if (__atomic_load_n(&owner[target], __ATOMIC_RELAXED) != p) continue;
+            __atomic_store_n(&owner[target], UINT32_MAX, __ATOMIC_RELAXED);
+            sc->mark[target] = gen;
+            if (sh->found_len == sh->found_cap) {
+                uint32_t cap = sh->found_cap ? sh->found_cap * 2 : 1024;
+                uint32_t *found = realloc(sh->found, cap * sizeof(uint32_t));
+                if (found) sh->found = found;
+                float *found_score = realloc(sh->found_score, cap * sizeof(float));
+                if (found_score) sh->found_score = found_score;
+                if (!found || !found_score) { sh->failed = 1; continue; }
+                sh->found_cap = cap;
+            }
+            sh->found[sh->found_len] = target;
+            sh->found_score[sh->found_len++] = sc->score[p] * weight / 255.0f;
+        }
+    }
+}
+
+void *pool_worker(void *arg) {
+    Share *sh = arg;
+    Pool *pool = sh->pool;
+    uint32_t seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->round == seen && !pool->stop) pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->stop) break;
+        seen = pool->round;
+        int pass = pool->pass;
+        pthread_mutex_unlock(&pool->lock);
+        
+        if (pass) share_collect(sh); else share_claim(sh);
+        
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* Threads for a spread walk: one per core, within SPREAD_MAX_THREADS */
+uint32_t spread_threads() {
+    static uint32_t threads;
+    if (!threads) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n < 1 ? 1 : n > SPREAD_MAX_THREADS ? SPREAD_MAX_THREADS : (uint32_t)n;
+    }
+    return threads;
+}
+
+/* Start up to threads - 1 workers; fewer if the system refuses some */
+void pool_start(Graph *g, Pool *pool, uint32_t threads) {
+    *pool = (Pool){ .graph = g, .threads = 1 };
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->share[0].pool = pool;
+    while (pool->threads < threads) {
+        Share *sh = &pool->share[pool->threads];
+        sh->pool = pool;
+        if (pthread_create(&pool->thread[pool->threads], NULL, pool_worker, sh) != 0) break;
+        pool->threads++;
+    }
+}
+
+/* The graph's pool for one walk, started on first use and kept until
+ * melvin_close(); NULL if another walk has it or it has no workers, and
+ * this walk runs on its own thread */
+Pool *pool_take(Graph *g, const View *v, const Walk *w, Scratch *sc) {
+    if (!sc->owner) {
+        if (!(sc->owner = malloc(sc->cap * sizeof(uint32_t)))) return NULL;
+        memset(sc->owner, 0xFF, sc->cap * sizeof(uint32_t));
+    }
+    if (pthread_mutex_trylock(&g->pool_lock) != 0) return NULL;
+    if (!g->pool && (g->pool = malloc(sizeof(Pool)))) pool_start(g, g->pool, spread_threads());
+    Pool *pool = g->pool;
+    if (!pool || pool->threads < 2) {
+        pthread_mutex_unlock(&g->pool_lock);
+        return NULL;
+    }
+    pool->v = v; pool->w = w; pool->sc = sc;
+    for (uint32_t i = 0; i < pool->threads; i++) pool->share[i].failed = 0;
+    return pool;
+}
+
+void pool_give(Pool *pool) {
+    pthread_mutex_unlock(&pool->graph->pool_lock);
+}
+
+void pool_pass(Pool *pool, int pass) {
+    pthread_mutex_lock(&pool->lock);
+    pool->pass = pass;
+    pool->pending = pool->threads - 1;
+    pool->round++;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    
+    if (pass) share_collect(&pool->share[0]); else share_claim(&pool->share[0]);
+    
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_stop(Pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (uint32_t i = 1; i < pool->threads; i++) pthread_join(pool->thread[i], NULL);
+    for (uint32_t i = 0; i < pool->threads; i++) {
+        free(pool->share[i].found);
+        free(pool->share[i].found_score);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+}
+
+/* Expand frontier [q_start, level_end) across the pool and append the next
+ * level at level_end; returns the new end of the queue, or UINT32_MAX if
+ * a share ran out of memory. Adds the edges looked at to *edges. */
+uint32_t spread_level(Pool *pool, uint32_t q_start, uint32_t level_end, uint64_t *edges) {
+    uint32_t len = level_end - q_start, n = pool->threads;
+    for (uint32_t i = 0; i < n; i++) {
+        pool->share[i].edges = 0;
+        pool->share[i].first = q_start + (uint32_t)((uint64_t)len * i / n);
+        pool->share[i].last = q_start + (uint32_t)((uint64_t)len * (i + 1) / n);
+    }
+    pool_pass(pool, 0);
+    pool_pass(pool, 1);
+    
+    uint32_t q_end = level_end;
+    for (uint32_t i = 0; i < n; i++) {
+        Share *sh = &pool->share[i];
+        *edges += sh->edges;
+        if (sh->failed) return UINT32_MAX;
+        memcpy(&pool->sc->queue[q_end], sh->found, sh->found_len * sizeof(uint32_t));
+        memcpy(&pool->sc->score[q_end], sh->found_score, sh->found_len * sizeof(float));
+        q_end += sh->found_len;
+    }
+    return q_end;
+}
+
+/* Breadth-first walk from the sources at the head of the queue, in
+ * discovery order, level by level. A spread walk hands large levels to
+ * a pool of threads; the result is the same. */
+uint32_t walk_bfs(Scratch *sc, const View *v, const Walk *w) {
+    uint32_t *queue = sc->queue, *mark = sc->mark, gen = sc->gen;
+    float *score = sc->score;
+    uint32_t limit = w->max_visited ? w->max_visited : UINT32_MAX;
+    uint32_t q_start = 0, q_end = sc->sources, depth = 0;
+    uint64_t edges = 0;
+    Pool *pool = NULL;
+    int tried = 0;
+    
+    // Follow edges until no more new nodes found (or a bound is hit)
+    while (q_start < q_end && q_end < limit && !(w->max_depth && depth >= w->max_depth)) {
+        uint32_t level_end = q_end;
+        STAT_MAX(frontier_max, level_end - q_start);
+        if (w->spread && level_end - q_start >= SPREAD_MIN_FRONTIER && spread_threads() > 1 && !tried) {
+            pool = pool_take(v->g, v, w, sc);
+            tried = 1;
+        }
+        if (pool && level_end - q_start >= SPREAD_MIN_FRONTIER) {
+            q_end = spread_level(pool, q_start, level_end, &edges);
+            if (q_end == UINT32_MAX) {
+                // Claims the failed share never collected are still set
+                fprintf(stderr, "melvin: out of memory in walk\n");
+                free(sc->owner);
+                sc->owner = NULL;
+                q_end = level_end;
+                break;
+            }
+            if (q_end > limit) q_end = limit;
+        } else {
+            while (q_start < level_end && q_end < limit) {
+                uint32_t current = queue[q_start];
+                float s = score[q_start++];
+                Cursor it = out_edges(v, current, w->min_weight);
+                uint32_t target;
+                uint8_t weight;
+                while (q_end < limit && next_edge(v, &it, &target, &weight)) {
+                    edges++;
+                    if (mark[target] == gen) continue;
+                    mark[target] = gen;
+                    queue[q_end] = target;
+                    score[q_end++] = s * weight / 255.0f;
+                }
+            }
+        }
+        q_start = level_end;
+        depth++;
+    }
+    if (pool) pool_give(pool);
+    STAT_ADD(walk_levels, depth);
+    STAT_ADD(walk_edges, edges);
+    return q_end;
+}
+
+int pending_before(const Pending *a, const Pending *b) {
+    return a->score > b->score || (a->score == b->score && a->seq < b->seq);
+}
+
+int heap_push(Scratch *sc, Pending p) {
+    if (sc->heap_len == sc->heap_cap) {
+        uint32_t cap = sc->heap_cap ? sc->heap_cap * 2 : 1024;
+        Pending *heap = realloc(sc->heap, cap * sizeof(Pending));
+        if (!heap) return 0;
+        sc->heap = heap;
+        sc->heap_cap = cap;
+    }
+    uint32_t i = sc->heap_len++;
+    while (i > 0 && pending_before(&p, &sc->heap[(i - 1) / 2])) {
+        sc->heap[i] = sc->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    sc->heap[i] = p;
+    return 1;
+}
+
+Pending heap_pop(Scratch *sc) {
+    Pending top = sc->heap[0], last = sc->heap[--sc->heap_len];
+    uint32_t i = 0, n = sc->heap_len;
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= n) break;
+        if (child + 1 < n && pending_before(&sc->heap[child + 1], &sc->heap[child])) child++;
+        if (!pending_before(&sc->heap[child], &last)) break;
+        sc->heap[i] = sc->heap[child];
+        i = child;
+    }
+    if (n) sc->heap[i] = last;
+    return top;
+}
+
+/* Queue the neighbours of a node the best-first walk just settled */
+int expand_best(Scratch *sc, const View *v, const Walk *w, Pending p, uint32_t *seq, uint64_t *edges) {
+    if (w->max_depth && p.depth >= w->max_depth) return 1;
+    Cursor it = out_edges(v, p.node, w->min_weight);
+    uint32_t target;
+    uint8_t weight;
+    while (next_edge(v, &it, &target, &weight)) {
+        (*edges)++;
+        if (sc->mark[target] == sc->gen) continue;
+        Pending next = { p.score * weight / 255.0f, (*seq)++, target, p.depth + 1 };
+        if (!heap_push(sc, next)) return 0;
+    }
+    return 1;
+}
+
+/* Best-first walk: nodes come out strongest path first. Scores never grow
+ * along a path, so a node's first pop is its best. */
+uint32_t walk_best(Scratch *sc, const View *v, const Walk *w) {
+    uint32_t *queue = sc->queue, *mark = sc->mark, gen = sc->gen;
+    float *score = sc->score;
+    uint32_t limit = w->max_visited ? w->max_visited : UINT32_MAX;
+    if (w->top_k && limit > sc->sources && w->top_k < limit - sc->sources) limit = sc->sources + w->top_k;
+    uint32_t q_end = sc->sources, seq = 0;
+    uint64_t edges = 0;
+    int ok = 1;
+    
+    sc->heap_len = 0;
+    for (uint32_t i = 0; ok && i < sc->sources; i++) {
+        ok = expand_best(sc, v, w, (Pending){1.0f, 0, queue[i], 0}, &seq, &edges);
+    }
+    while (ok && sc->heap_len && q_end < limit) {
+        Pending p = heap_pop(sc);
+        if (mark[p.node] == gen) continue;
+        mark[p.node] = gen;
+        queue[q_end] = p.node;
+        score[q_end++] = p.score;
+        ok = expand_best(sc, v, w, p, &seq, &edges);
+    }
+    STAT_ADD(walk_edges, edges);
+    return q_end;
+}
+
+/* Walk from the start nodes within the bounds; sc->queue holds the
+ * distinct starts (sc->sources of them) and then the nodes reached,
+ * sc->score their path scores. Returns how many in all. */
+uint32_t traverse(Graph *g, Scratch *sc, const uint32_t *starts, uint32_t n, const Walk *w) {
+    uint64_t t = STAT_NOW();
+    View v = view_begin(g);
+    if (!scratch_begin(sc, v.node_count)) return 0;
+    sc->sources = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (sc->mark[starts[i]] == sc->gen) continue;
+        sc->mark[starts[i]] = sc->gen;
+        sc->queue[sc->sources] = starts[i];
+        sc->score[sc->sources++] = 1.0f;
+    }
+    uint32_t reached = w->top_k ? walk_best(sc, &v, w) : walk_bfs(sc, &v, w);
+    STAT_ADD(walks, 1);
+    STAT_ADD(walk_visited, reached);
+    STAT_ADD(walk_ns, STAT_NOW() - t);
+    return reached;
+}
+
+/* Token of the v-th node a walk reached, wherever that walk keeps them */
+typedef uint8_t *(*WalkToken)(void *ctx, const Scratch *sc, uint32_t v, uint32_t *len);
+
+/* Text of a walk: its distinct starts (the first sources nodes), then the
+ * first nodes reached from them (all K for a top-K walk), one line in
+ * sc->text; returns its length */
+size_t walk_text(Scratch *sc, uint32_t reached, uint32_t sources, uint32_t top_k, WalkToken token, void *ctx) {
+    uint32_t shown = sources + (top_k ? top_k : WALK_SHOWN), n;
+    if (shown > reached) shown = reached;
+    size_t len = 1 + 4;     // "\n", and " → " in place of one space
+    for (uint32_t v = 0; v < shown; v++) {
+        token(ctx, sc, v, &n);
+        len += n + 1;
+    }
+    if (len > sc->text_cap) {
+        char *text = realloc(sc->text, len);
+        if (!text) return 0;
+        sc->text = text;
+        sc->text_cap = len;
+    }
+    
+    char *p = sc->text;
+    for (uint32_t v = 0; v < shown; v++) {
+        uint8_t *bytes = token(ctx, sc, v, &n);
+        memcpy(p, bytes, n);
+        p += n;
+        if (v + 1 == sources) {
+            memcpy(p, " → ", 5);
+            p += 5;
+        } else {
+            *p++ = ' ';
+        }
+    }
+    *p++ = '\n';
+    return p - sc->text;
+}
+
+uint8_t *graph_walk_token(void *ctx, const Scratch *sc, uint32_t v, uint32_t *len) {
+    Graph *g = ctx;
+    *len = g->token_len[sc->queue[v]];
+    return node_token(g, sc->queue[v]);
+}
+
+/* walk_text() of a walk on one graph, in sc->queue */
+size_t reached_text(Graph *g, Scratch *sc, uint32_t reached) {
+    return walk_text(sc, reached, sc->sources, g->walk.top_k, graph_walk_token, g);
+}
+
+void print_reached(Graph *g, Scratch *sc, FILE *out, uint32_t reached) {
+    size_t len = reached_text(g, sc, reached);
+    if (len) fwrite(sc->text, 1, len, out);
+    else fprintf(stderr, "melvin: out of memory for walk output\n");
+}
+
+/*
+ * Query cache: a walk's text by start nodes and bounds. An entry is only
+ * served while the graph generation is the one it was computed at, so any
+ * change (node, edge, weight) retires every entry at once.
+ */
+uint64_t cache_hash(const uint32_t *starts, uint32_t n, const Walk *w) {
+    uint64_t h = 14695981039346656037ull ^ n;
+    uint32_t bounds[5] = { w->max_depth, w->max_visited, w->top_k, w->min_weight, w->spread };
+    for (uint32_t i = 0; i < n; i++) h = (h ^ starts[i]) * 1099511628211ull;
+    for (int i = 0; i < 5; i++) h = (h ^ bounds[i]) * 1099511628211ull;
+    return h;
+}
+
+int walk_equal(const Walk *a, const Walk *b) {
+    return a->max_depth == b->max_depth && a->max_visited == b->max_visited && a->top_k == b->top_k &&
+           a->min_weight == b->min_weight && a->spread == b->spread;
+}
+
+/* Entry for the key, UINT32_MAX if none; with c->lock held */
+uint32_t cache_find(Cache *c, uint64_t h, const uint32_t *starts, uint32_t n, const Walk *w) {
+    for (uint32_t i = c->buckets[h & c->mask]; i != UINT32_MAX; i = c->entries[i].chain) {
+        CacheEntry *e = &c->entries[i];
+        if (e->hash == h && e->n == n && walk_equal(&e->walk, w) &&
+            memcmp(e->starts, starts, n * sizeof(uint32_t)) == 0) return i;
+    }
+    return UINT32_MAX;
+}
+
+void lru_unlink(Cache *c, uint32_t i) {
+    CacheEntry *e = &c->entries[i];
+    if (e->prev != UINT32_MAX) c->entries[e->prev].next = e->next;
+    else c->head = e->next;
+    if (e->next != UINT32_MAX) c->entries[e->next].prev = e->prev;
+    else c->tail = e->prev;
+}
+
+void lru_push(Cache *c, uint32_t i) {
+    CacheEntry *e = &c->entries[i];
+    e->prev = UINT32_MAX;
+    e->next = c->head;
+    if (c->head != UINT32_MAX) c->entries[c->head].prev = i;
+    c->head = i;
+    if (c->tail == UINT32_MAX) c->tail = i;
+}
+
+void cache_clear(Cache *c) {
+    for (uint32_t i = 0; i < c->used; i++) {
+        free(c->entries[i].starts);
+        free(c->entries[i].text);
+    }
+    free(c->entries);
+    free(c->buckets);
+    c->entries = NULL;
+    c->buckets = NULL;
+    c->used = 0;
+}
+
+/* Print the cached walk for these starts, if one is current; 0 on a miss */
+int cache_print(Graph *g, Scratch *sc, const uint32_t *starts, uint32_t n, FILE *out) {
+    Cache *c = &g->cache;
+    if (!RELAXED(c->cap) || n > CACHE_MAX_STARTS) return 0;
+    uint64_t h = cache_hash(starts, n, &g->walk);
+    size_t len = 0;
+    pthread_mutex_lock(&c->lock);
+    uint32_t i = c->entries ? cache_find(c, h, starts, n, &g->walk) : UINT32_MAX;
+    if (i != UINT32_MAX && c->entries[i].generation == LOAD(g->generation)) {
+        // Copied out: the client may be slow to read, keep the lock short
+        CacheEntry *e = &c->entries[i];
+        lru_unlink(c, i);
+        lru_push(c, i);
+        char *text = e->len <= sc->text_cap ? sc->text : realloc(sc->text, e->len);
+        if (text) {
+            if (e->len > sc->text_cap) sc->text_cap = e->len;
+            sc->text = text;
+            memcpy(text, e->text, e->len);
+            len = e->len;
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+    if (!len) {
+        STAT_ADD(cache_misses, 1);
+        return 0;
+    }
+    fwrite(sc->text, 1, len, out);
+    STAT_ADD(cache_hits, 1);
+    return 1;
+}
+
+/* Remember a walk's text, computed at generation gen; evicts the least
+ * recently used entry when full */
+void cache_put(Graph *g, const uint32_t *starts, uint32_t n, uint64_t gen, const char *text, size_t len) {
+    Cache *c = &g->cache;
+    if (!RELAXED(c->cap) || n > CACHE_MAX_STARTS || len > UINT32_MAX) return;
+    char *copy = malloc(len);
+    uint32_t *key = malloc(n * sizeof(uint32_t) + 1);
+    if (!copy || !key) { free(copy); free(key); return; }
+    memcpy(copy, text, len);
+    memcpy(key, starts, n * sizeof(uint32_t));
+    uint64_t h = cache_hash(starts, n, &g->walk);
+    
+    // melvin_set_cache() may have turned the cache off since the check above
+    pthread_mutex_lock(&c->lock);
+    if (!c->cap) {
+        pthread_mutex_unlock(&c->lock);
+        free(copy); free(key);
+        return;
+    }
+    if (!c->entries) {
+        uint32_t buckets = HASH_MIN_CAP;
+        while (buckets < c->cap) buckets <<= 1;
+        c->entries = malloc(c->cap * sizeof(CacheEntry));
+        c->buckets = malloc(buckets * sizeof(uint32_t));
+        if (!c->entries || !c->buckets) {
+            free(c->entries); free(c->buckets);
+            c->entries = NULL; c->buckets = NULL;
+            pthread_mutex_unlock(&c->lock);
+            free(copy); free(key);
+            return;
+        }
+        memset(c->buckets, 0xFF, buckets * sizeof(uint32_t));
+        c->mask = buckets - 1;
+        c->used = 0;
+        c->head = c->tail = UINT32_MAX;
+    }
+    
+    uint32_t i = cache_find(c, h, starts, n, &g->walk);
+    if (i != UINT32_MAX) {
+        lru_unlink(c, i);
+    } else {
+        if (c->used < c->cap) {
+            i = c->used++;
+            c->entries[i].starts = NULL;
+            c->entries[i].text = NULL;
+        } else {
+            // Reuse the coldest entry: out of the LRU list and its bucket
+            i = c->tail;
+            lru_unlink(c, i);
+            uint32_t *link = &c->buckets[c->entries[i].hash & c->mask];
+            while (*link != i) link = &c->entries[*link].chain;
+            *link = c->entries[i].chain;
+        }
+        c->entries[i].chain = c->buckets[h & c->mask];
+        c->buckets[h & c->mask] = i;
+    }
+    CacheEntry *e = &c->entries[i];
+    free(e->starts);
+    free(e->text);
+    e->hash = h;
+    e->generation = gen;
+    e->starts = key;
+    e->n = n;
+    e->walk = g->walk;
+    e->text = copy;
+    e->len = len;
+    lru_push(c, i);
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* Dispatch a line's rule: a graph with a rule for lines this long
+ * ("rule_3token") also walks from the nodes the rule points to, after the
+ * line's own starts. Returns the starts unchanged if there is none. */
+const uint32_t *rule_starts(Graph *g, Scratch *sc, const uint32_t *starts, uint32_t *n, uint32_t count) {
+    uint32_t rule = rule_for(g, count);
+    if (rule == UINT32_MAX) return starts;
+    
+    View v = view_begin(g);
+    Cursor it = out_edges(&v, rule, g->walk.min_weight);
+    uint32_t len = *n, target;
+    uint8_t weight;
+    while (next_edge(&v, &it, &target, &weight)) {
+        if (len + 1 > sc->starts_cap) {
+            uint32_t cap = sc->starts_cap ? sc->starts_cap * 2 : 64;
+            while (cap < len + 1) cap *= 2;
+            uint32_t *grown = realloc(sc->starts, cap * sizeof(uint32_t));
+            if (!grown) return starts;
+            sc->starts = grown;
+            sc->starts_cap = cap;
+        }
+        if (len == *n) memcpy(sc->starts, starts, *n * sizeof(uint32_t));
+        sc->starts[len++] = target;
+    }
+    if (len == *n) return starts;
+    *n = len;
+    return sc->starts;
+}
+
+/* Finish routing a line fed through st (which linked its tokens as they
+ * came): walk from the last token, following ALL edges until exhausted.
+ * Returns the number of tokens; prints nothing for an empty line or out == NULL. */
+int route_end(Graph *g, Stream *st, FILE *out) {
+    stream_flush(st);
+    uint32_t count = st->count;
+    
+    if (count == 0) return 0;
+    
+    // Rebuild the CSR once too many edges sit past it
+    if (csr_stale(g)) csr_rebuild(g);
+    
+    uint32_t n;
+    const uint32_t *starts = rule_starts(g, &scratch, stream_starts(st, &n), &n, count);
+    uint32_t reached = traverse(g, &scratch, starts, n, &g->walk);
+    if (out && reached) print_reached(g, &scratch, out, reached);
+    return count;
+}
+
+/* Query: like route_end() but read-only; unknown tokens are skipped and the
+ * walk starts from the last known one. Returns the number of known tokens. */
+int query_end(Graph *g, Stream *st, FILE *out) {
+    Scratch *sc = &scratch;
+    stream_flush(st);
+    if (st->count == 0) return 0;
+    
+    uint32_t n;
+    const uint32_t *starts = rule_starts(g, sc, stream_starts(st, &n), &n, st->count);
+    if (out && cache_print(g, sc, starts, n, out)) return st->count;
+    
+    // The generation before the walk: a change during it retires the entry
+    uint64_t gen = LOAD(g->generation);
+    uint32_t reached = traverse(g, sc, starts, n, &g->walk);
+    if (out && reached) {
+        size_t len = reached_text(g, sc, reached);
+        if (len) {
+            fwrite(sc->text, 1, len, out);
+            cache_put(g, starts, n, gen, sc->text, len);
+        }
+    }
+    return st->count;
+}
+
+/* Start a line on one graph: learn creates its tokens and links them */
+void line_begin(Graph *g, Stream *st, int learn) {
+    stream_begin(st, g, g->delim, learn ? resolve_create : resolve_find, learn ? link_edge : NULL, g->walk.spread);
+}
+
+/* Route (or query) one whole line held in memory; the thread's line
+ * stream keeps its buffers for the next call */
+int route(Graph *g, const char *input, FILE *out) {
+    Stream *st = &scratch.line;
+    line_begin(g, st, 1);
+    stream_feed(st, input, strlen(input));
+    return route_end(g, st, out);
+}
+
+int query(Graph *g, const char *input, FILE *out) {
+    Stream *st = &scratch.line;
+    line_begin(g, st, 0);
+    stream_feed(st, input, strlen(input));
+    return query_end(g, st, out);
+}
+
+/* Save graph: pages are already in the file, only the header counts lag;
+ * the log makes the changes durable */
+void save(Graph *g) {
+    uint64_t t = STAT_NOW();
+    sync_header(g);
+    log_commit(g, 1);
+    STAT_ADD(save_ns, STAT_NOW() - t);
+}
+
+/* Sections whose used bytes no longer match their checksum, a bit each */
+uint64_t section_errors(Graph *g) {
+    uint64_t bad = 0;
+    for (uint32_t s = 0; s < g->hdr->section_count; s++) {
+        Section *sec = &g->hdr->sections[s];
+        if (melvin_crc32(0, g->map + sec->offset, sec->used) != sec->crc) bad |= 1ull << s;
+    }
+    return bad;
+}
+
+/* Why the arrays of a just-mapped graph can't be followed, NULL if they
+ * can: every token lies in the arena and every edge joins two nodes. A
+ * sealed file must also match its checksums; a peeker may see the writer
+ * unseal it meanwhile. */
+const char *graph_check(Graph *g) {
+    for (uint32_t i = 0; i < g->node_count; i++) {
+        if ((uint64_t)g->token_off[i] + g->token_len[i] > g->arena_used) return "token outside the arena";
+    }
+    for (uint32_t e = 0; e < g->edge_count; e++) {
+        if (g->edge_from[e] >= g->node_count || g->edge_to[e] >= g->node_count) return "edge to a missing node";
+    }
+    if ((g->hdr->flags & F_SEALED) && section_errors(g) && (LOAD(g->hdr->flags) & F_SEALED)) {
+        return "section checksum mismatch";
+    }
+    return NULL;
+}
+
+/* A CSR set fits the graph: rows ascend, slots name nodes and edges */
+int csr_fits(Graph *g, Csr *c) {
+    if (c->nodes > g->node_count || c->edges > g->edge_count || c->off[0] != 0 || c->off[c->nodes] != c->edges) {
+        return 0;
+    }
+    for (uint32_t n = 0; n < c->nodes; n++) {
+        if (c->off[n] > c->off[n + 1]) return 0;
+    }
+    for (uint32_t k = 0; k < c->edges; k++) {
+        if (c->to[k] >= g->node_count || c->pos[k] >= c->edges) return 0;
+    }
+    return 1;
+}
+
+/* Map an open graph file; fails on a header that does not fit the file or
+ * arrays that don't fit the header */
+int attach(Graph *g, int fd, size_t size, int readonly) {
+    if (size < sizeof(Header)) return 0;
+    char *map = mmap(NULL, size, readonly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return 0;
+    
+    Header *h = (Header*)map;
+    const char *why = melvin_check(h, size);
+    if (why) {
+        // Copy-in files are upgraded quietly by load()
+        if (h->magic == MELVIN_MAGIC) {
+            fprintf(stderr, "melvin: %s: %s\n", g->path, why);
+        } else if (readonly) {
+            fprintf(stderr, "melvin: %s: older format (open it for writing once to upgrade)\n", g->path);
+        }
+        munmap(map, size);
+        return 0;
+    }
+    
+    g->fd = fd; g->map = map; g->map_size = size; g->hdr = h;
+    g->readonly = readonly;
+    map_arrays(g);
+    g->node_count = h->node_count; g->edge_count = h->edge_count;
+    g->arena_used = h->arena_used;
+    g->csr_live = h->csr_set & 1;
+    Csr *c = &g->csr[g->csr_live];
+    c->nodes = h->csr_nodes; c->edges = h->csr_edges;
+    if (!csr_fits(g, c)) c->nodes = c->edges = 0;     // Rebuilt before use
+    if ((why = graph_check(g))) fprintf(stderr, "melvin: %s: %s\n", g->path, why);
+    if (why || !tail_alloc(g, g->node_cap, g->edge_cap)) {
+        // The caller still owns fd
+        munmap(map, size);
+        g->map = NULL; g->hdr = NULL; g->fd = -1;
+        return 0;
+    }
+    
+    // Sections from a newer writer can't be kept in sync by this one: drop them
+    if (!readonly && h->section_count > S_COUNT) {
+        memset(&h->sections[S_COUNT], 0, (h->section_count - S_COUNT) * sizeof(Section));
+        h->section_count = S_COUNT;
+    }
+    if (!readonly) sync_header(g);
+    return 1;
+}
+
+/* Size an empty file for the given capacities and map it */
+int format(Graph *g, int fd, uint32_t node_cap, uint32_t edge_cap, uint32_t hash_cap, uint32_t ehash_cap,
+           uint32_t arena_cap) {
+    Header h = {0};
+    h.magic = MELVIN_MAGIC;
+    h.version = MELVIN_VERSION;
+    h.node_cap = node_cap; h.edge_cap = edge_cap;
+    h.hash_cap = hash_cap; h.ehash_cap = ehash_cap;
+    h.arena_cap = arena_cap;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    h.graph_id = (uint32_t)(ts.tv_sec ^ ts.tv_nsec ^ ((uint32_t)getpid() << 16));
+    size_t size = layout(&h);
+    h.header_crc = melvin_header_crc(&h);
+    return ftruncate(fd, 0) == 0 && ftruncate(fd, size) == 0 &&
+           pwrite(fd, &h, sizeof(h), 0) == sizeof(h) && attach(g, fd, size, 0);
+}
+
+/* Take the writer (LOCK_EX) or reader (LOCK_SH) lock; a server holds it for a while */
+int lock(Graph *g, int fd, int op) {
+    if (flock(fd, op | LOCK_NB) == 0) return 1;
+    if (errno != EWOULDBLOCK) return 0;
+    fprintf(stderr, "melvin: waiting for %s (in use by another process)\n", g->path);
+    return flock(fd, op) == 0;
+}
+
+/* Open melvin.mmap and take its lock (op 0: none), -1 on failure. Compaction
+ * renames a new file over the path; one who waited for the lock meanwhile
+ * holds the old, unlinked file, and opens the path again. */
+int open_locked(Graph *g, int flags, int op) {
+    for (;;) {
+        int fd = open(g->path, flags, 0644);
+        if (fd < 0 || !op) return fd;
+        struct stat held, named;
+        if (!lock(g, fd, op) || fstat(fd, &held) != 0) { close(fd); return -1; }
+        if (stat(g->path, &named) == 0 && named.st_dev == held.st_dev && named.st_ino == held.st_ino) return fd;
+        close(fd);
+    }
+}
+
+/* A graph in an older file, read in place */
+typedef struct {
+    uint32_t node_count, edge_count;
+    const PackedNode *nodes;        // Copy-in files...
+    const uint32_t *token_off;      // ...or node arrays
+    const uint16_t *token_len;
+    const uint8_t *arena;
+    uint32_t arena_used;
+    const PackedEdge *edges;
+} OldGraph;
+
+/* Token of an old node; packed records kept 16 bytes of a longer token,
+ * and those bytes become the token */
+const uint8_t *old_token(const OldGraph *o, uint32_t i, uint32_t *len) {
+    if (!o->nodes) {
+        *len = o->token_len[i];
+        return o->arena + o->token_off[i];
+    }
+    *len = o->nodes[i].token_len < 16 ? o->nodes[i].token_len : 16;
+    return o->nodes[i].token;
+}
+
+/* Write an older (or compacted) graph into a fresh, sealed file that
+ * replaces melvin.mmap; values are parsed from the tokens again (copy-in
+ * files hold 0 for "-7"), indexes and the CSR are rebuilt */
+int convert(Graph *g, const OldGraph *o) {
+    uint64_t arena = 0;
+    uint32_t len;
+    for (uint32_t i = 0; i < o->node_count; i++) {
+        old_token(o, i, &len);
+        arena += len;
+        if (!o->nodes && (uint64_t)o->token_off[i] + len > o->arena_used) {
+            fprintf(stderr, "melvin: %s: token outside the arena\n", g->path);
+            return 0;
+        }
+    }
+    if (arena > ID_MAX) return 0;
+    for (uint32_t e = 0; e < o->edge_count; e++) {
+        if (o->edges[e].from >= o->node_count || o->edges[e].to >= o->node_count) {
+            fprintf(stderr, "melvin: %s: edge to a missing node\n", g->path);
+            return 0;
+        }
+    }
+    
+    char tmp[PATH_MAX + 4];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", g->path);
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return 0;
+    uint32_t node_cap = o->node_count > NODE_MIN_CAP ? o->node_count : NODE_MIN_CAP;
+    uint32_t edge_cap = o->edge_count > EDGE_MIN_CAP ? o->edge_count : EDGE_MIN_CAP;
+    uint32_t arena_cap = arena > ARENA_MIN_CAP ? (uint32_t)arena : ARENA_MIN_CAP;
+    if (!lock(g, fd, LOCK_EX) || !format(g, fd, node_cap, edge_cap, hash_cap_for(o->node_count),
+                                      hash_cap_for(o->edge_count), arena_cap)) {
+        close(fd);
+        return 0;
+    }
+    
+    for (uint32_t i = 0; i < o->node_count; i++) {
+        const uint8_t *token = old_token(o, i, &len);
+        memcpy(g->arena + g->arena_used, token, len);
+        g->token_off[i] = g->arena_used;
+        g->token_len[i] = len;
+        g->value[i] = 0;
+        parse_number(token, len, &g->value[i]);
+        g->arena_used += len;
+    }
+    for (uint32_t e = 0; e < o->edge_count; e++) {
+        g->edge_from[e] = o->edges[e].from;
+        g->edge_to[e] = o->edges[e].to;
+        g->edge_w[e] = o->edges[e].weight;
+    }
+    g->node_count = o->node_count; g->edge_count = o->edge_count;
+    hash_rebuild(g);
+    ehash_rebuild(g);
+    rule_rebuild(g);
+    value_rebuild(g);
+    csr_rebuild(g);
+    
+    // On disk before it replaces the old file
+    seal(g);
+    msync(g->map, g->map_size, MS_SYNC);
+    return rename(tmp, g->path) == 0;
+}
+
+/* Does an array of n elements at off fit in the file? */
+int fits(size_t size, uint64_t off, uint64_t n, size_t elem) {
+    return off <= size && (size - off) / elem >= n;
+}
+
+/* Upgrade a file of the pre-header copy-in format [counts][nodes][edges] */
+int upgrade(Graph *g, const char *mem, size_t size) {
+    uint32_t h[4] = {0};
+    if (size >= sizeof(h)) memcpy(h, mem, sizeof(h));
+    OldGraph o = {0};
+    
+    size_t need = 4 * sizeof(uint32_t) + (size_t)h[0] * sizeof(PackedNode) + (size_t)h[2] * sizeof(PackedEdge);
+    if (size < 4 * sizeof(uint32_t) || need > size) return 0;
+    o.node_count = h[0]; o.edge_count = h[2];
+    o.nodes = (const PackedNode*)(mem + 4 * sizeof(uint32_t));
+    o.edges = (const PackedEdge*)(mem + 4 * sizeof(uint32_t) + (size_t)h[0] * sizeof(PackedNode));
+    return convert(g, &o);
+}
+
+/* Map melvin.mmap in place, creating or upgrading it as needed */
+int load_graph(Graph *g) {
+    int fd = open_locked(g, O_RDWR | O_CREAT, LOCK_EX);
+    if (fd < 0) return 0;
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); return 0; }
+    if (attach(g, fd, st.st_size, 0)) return 1;
+    
+    // A graph that failed its checks is left alone for inspection
+    uint32_t magic = 0;
+    if (pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) && magic == MELVIN_MAGIC) {
+        close(fd);
+        return 0;
+    }
+    
+    // Not a graph: either new/empty or a copy-in file
+    if (st.st_size < (off_t)(sizeof(uint32_t) * 4)) {
+        if (format(g, fd, NODE_MIN_CAP, EDGE_MIN_CAP, HASH_MIN_CAP, HASH_MIN_CAP, ARENA_MIN_CAP)) return 1;
+        close(fd);
+        return 0;
+    }
+    
+    int ok = 0;
+    void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mem != MAP_FAILED) {
+        ok = upgrade(g, mem, st.st_size);
+        munmap(mem, st.st_size);
+    }
+    close(fd);
+    return ok;
+}
+
+/* Apply melvin.log on top of the checkpoint it starts from; records are
+ * absolute, so ones the mapping already shows are harmlessly redone */
+uint32_t replay(Graph *g, const LogHeader *lh) {
+    uint32_t n = lh->node_count, m = lh->edge_count, applied = 0;
+    if (n > g->node_cap || m > g->edge_cap || lh->arena_used > g->arena_cap) return 0;
+    uint32_t arena = lh->arena_used;
+    
+    LogRecord r;
+    for (off_t at = sizeof(*lh); pread(g->log_fd, &r, sizeof(r), at) == sizeof(r); at += sizeof(r)) {
+        // A torn or unsynced tail ends the log
+        if (r.crc != melvin_crc32(0, &r, offsetof(LogRecord, crc))) break;
+        if (r.type == L_NODE && r.id <= n && r.id < g->node_cap &&
+            r.from <= g->arena_cap && r.token_len <= g->arena_cap - r.from) {
+            g->token_off[r.id] = r.from;
+            g->token_len[r.id] = r.token_len;
+            g->value[r.id] = r.value;
+            memcpy(g->arena + r.from, r.token, r.token_len < sizeof(r.token) ? r.token_len : sizeof(r.token));
+            if (r.from + r.token_len > arena) arena = r.from + r.token_len;
+            if (r.id == n) n++;
+        } else if (r.type == L_TOKEN && r.id < n && r.from < g->token_len[r.id]) {
+            uint32_t left = g->token_len[r.id] - r.from;
+            memcpy(g->arena + g->token_off[r.id] + r.from, r.token, left < sizeof(r.token) ? left : sizeof(r.token));
+        } else if (r.type == L_EDGE && r.id <= m && r.id < g->edge_cap) {
+            g->edge_from[r.id] = r.from;
+            g->edge_to[r.id] = r.to;
+            g->edge_w[r.id] = r.weight;
+            if (r.id == m) m++;
+        } else if (r.type == L_WEIGHT && r.id < m) {
+            g->edge_w[r.id] = r.weight;
+        } else {
+            break;
+        }
+        applied++;
+    }
+    
+    // Whatever else the mapping holds past the log is not trusted: reindex
+    g->node_count = n; g->edge_count = m;
+    g->arena_used = arena;
+    hash_rebuild(g);
+    ehash_rebuild(g);
+    rule_rebuild(g);
+    value_rebuild(g);
+    g->csr[g->csr_live].nodes = g->csr[g->csr_live].edges = 0;
+    if (!tail_alloc(g, g->node_cap, g->edge_cap)) return 0;
+    return applied;
+}
+
+/* Open melvin.log. Written in this boot, the mapping already shows it and
+ * we append; otherwise (or when asked) replay it, then start a fresh one */
+int log_open(Graph *g, int recover) {
+    g->log_fd = open(g->log_path, O_RDWR | O_CREAT, 0644);
+    if (g->log_fd < 0) return 0;
+    
+    LogHeader lh;
+    char boot[sizeof(lh.boot_id)];
+    boot_id(boot);
+    struct stat st;
+    int valid = fstat(g->log_fd, &st) == 0 && pread(g->log_fd, &lh, sizeof(lh), 0) == sizeof(lh) &&
+                lh.magic == LOG_MAGIC && lh.version == LOG_VERSION &&
+                lh.graph_id == g->hdr->graph_id && lh.log_seq == g->hdr->log_seq;
+    if (valid && !recover && memcmp(lh.boot_id, boot, sizeof(boot)) == 0) {
+        // Drop a record torn by a process that died mid-write
+        g->log_size = sizeof(lh) + (st.st_size - sizeof(lh)) / sizeof(LogRecord) * sizeof(LogRecord);
+        return 1;
+    }
+    
+    if (valid) {
+        uint32_t applied = replay(g, &lh);
+        if (applied) fprintf(stderr, "melvin: recovered %u changes from %s\n", applied, g->log_path);
+    }
+    checkpoint(g);
+    return 1;
+}
+
+/* Load graph for writing: the mapping plus its log */
+int load(Graph *g, int recover) {
+    uint64_t t = STAT_NOW();
+    g->locked = 1;
+    if (!load_graph(g) || !log_open(g, recover)) return 0;
+    STAT_ADD(load_bytes, g->map_size);
+    STAT_ADD(load_ns, STAT_NOW() - t);
+    return 1;
+}
+
+/* Load graph for queries only: shared lock (skipped when peeking),
+ * PROT_READ, never written */
+int load_readonly(Graph *g, int peek) {
+    uint64_t t = STAT_NOW();
+    int fd = open_locked(g, O_RDONLY, peek ? 0 : LOCK_SH);
+    if (fd < 0) return 0;
+    
+    struct stat st;
+    g->locked = !peek;
+    if (fstat(fd, &st) == 0 && attach(g, fd, st.st_size, 1)) {
+        STAT_ADD(load_bytes, g->map_size);
+        STAT_ADD(load_ns, STAT_NOW() - t);
+        return 1;
+    }
+    close(fd);
+    return 0;
+}
+
+/* Unmap graph */
+void unload(Graph *g) {
+    tail_free(g);
+    munmap(g->map, g->map_size);
+    close(g->fd);
+    if (g->log_fd >= 0) close(g->log_fd);
+}
+
+/* Checkpoint: publish counts, checksum sections and flush dirty pages to
+ * disk; the log up to here is then folded in and starts over */
+void checkpoint(Graph *g) {
+    uint64_t t = STAT_NOW();
+    
+    // A file at rest has a short tail, so opening it chains next to nothing
+    if (g->edge_count - g->csr[g->csr_live].edges > CSR_SLACK) csr_rebuild(g);
+    if (g->log_fd >= 0) g->hdr->log_seq++;
+    seal(g);
+    msync(g->map, g->map_size, MS_SYNC);
+    if (g->log_fd >= 0) log_reset(g);
+    STAT_ADD(checkpoints, 1);
+    STAT_ADD(checkpoint_bytes, g->map_size);
+    STAT_ADD(checkpoint_ns, STAT_NOW() - t);
+}
+
+/* Renumber a graph whose edges are grouped by source (row u is
+ * edges[row[u] .. row[u+1])) in breadth-first order, roots taken in id
+ * order: a node's out-neighbours get ids near its own, so a walk touches
+ * neighbouring memory and file pages. Rows keep their order. */
+int reorder_bfs(uint32_t n, uint32_t *row, uint32_t *token_off, uint16_t *token_len, PackedEdge *edges) {
+    uint32_t m = row[n];
+    uint32_t *rank = malloc(((uint64_t)n + 1) * sizeof(uint32_t));
+    uint32_t *queue = malloc(((uint64_t)n + 1) * sizeof(uint32_t));   // New id -> old
+    uint32_t *off = malloc(((uint64_t)n + 1) * sizeof(uint32_t));
+    uint16_t *len = malloc(((uint64_t)n + 1) * sizeof(uint16_t));
+    PackedEdge *e2 = malloc(((uint64_t)m + 1) * sizeof(PackedEdge));
+    int ok = rank && queue && off && len && e2;
+    if (ok) {
+        memset(rank, 0xFF, (uint64_t)n * sizeof(uint32_t));
+        uint32_t next = 0;
+        for (uint32_t r = 0; r < n; r++) {
+            if (rank[r] != UINT32_MAX) continue;
+            uint32_t q = next;
+            rank[r] = next;
+            queue[next++] = r;
+            for (; q < next; q++) {
+                uint32_t u = queue[q];
+                for (uint32_t k = row[u]; k < row[u + 1]; k++) {
+                    uint32_t v = edges[k].to;
+                    if (rank[v] != UINT32_MAX) continue;
+                    rank[v] = next;
+                    queue[next++] = v;
+                }
+            }
+        }
+        
+        // Gather nodes and rows in the new order, then copy back over the old
+        uint32_t k2 = 0;
+        for (uint32_t j = 0; j < n; j++) {
+            uint32_t u = queue[j];
+            off[j] = token_off[u]; len[j] = token_len[u];
+            for (uint32_t k = row[u]; k < row[u + 1]; k++) {
+                e2[k2++] = (PackedEdge){ .from = j, .to = rank[edges[k].to], .weight = edges[k].weight };
+            }
+            queue[j] = k2;  // Reused: end of new row j
+        }
+        for (uint32_t j = 0; j < n; j++) row[j + 1] = queue[j];
+        memcpy(token_off, off, (uint64_t)n * sizeof(uint32_t));
+        memcpy(token_len, len, (uint64_t)n * sizeof(uint16_t));
+        memcpy(edges, e2, (uint64_t)m * sizeof(PackedEdge));
+    }
+    free(rank); free(queue); free(off); free(len); free(e2);
+    return ok;
+}
+
+/* Swap the open graph's file for one written from o, readers held out
+ * (ids may change, the mapping is replaced); the old file stays on failure */
+int replace(Graph *g, const OldGraph *o) {
+    char *old_map = g->map;
+    size_t old_size = g->map_size;
+    int old_fd = g->fd;
+    __atomic_store_n(&g->gate, 1, __ATOMIC_SEQ_CST);
+    synchronize(g);
+    int ok = convert(g, o);
+    STORE(g->generation, g->generation + 1);
+    if (ok) {
+        munmap(old_map, old_size);
+        close(old_fd);
+        if (g->log_fd >= 0) log_reset(g);
+    } else if (g->map != old_map) {
+        // Written but not renamed into place: back to the old file
+        char tmp[PATH_MAX + 4];
+        snprintf(tmp, sizeof(tmp), "%s.tmp", g->path);
+        unlink(tmp);
+        munmap(g->map, g->map_size);
+        close(g->fd);
+        munmap(old_map, old_size);
+        attach(g, old_fd, old_size, 0);
+    }
+    __atomic_store_n(&g->gate, 0, __ATOMIC_SEQ_CST);
+    return ok;
+}
+
+/* Compact: weights lose decay percent, edges left lighter than min_weight
+ * go, and so do nodes no edge touches any more (rule nodes stay). The rest
+ * are renumbered densely, in first-seen order or (reorder) breadth-first,
+ * and written, edges grouped by source, to a fresh file that replaces the
+ * graph; readers are held out. */
+int compact(Graph *g, uint32_t decay, uint8_t min_weight, int reorder) {
+    sync_header(g);
+    uint32_t n = g->node_count, m = g->edge_count;
+    if (decay > 100) decay = 100;
+    uint32_t *id = malloc(((uint64_t)n + 1) * sizeof(uint32_t));  // Old id -> new, UINT32_MAX if dropped
+    uint8_t *w = malloc(m ? m : 1);
+    uint32_t *at = calloc((uint64_t)n + 1, sizeof(uint32_t));
+    if (!id || !w || !at) { free(id); free(w); free(at); return 0; }
+    
+    uint32_t nodes = 0, edges = 0;
+    for (uint32_t e = 0; e < m; e++) {
+        w[e] = g->edge_w[e] * (100 - decay) / 100;
+        if (w[e] < min_weight) continue;
+        at[g->edge_from[e]] = at[g->edge_to[e]] = 1;
+        edges++;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        int keep = at[i] || rule_tokens(node_token(g, i), g->token_len[i]) != UINT32_MAX;
+        id[i] = keep ? nodes++ : UINT32_MAX;
+    }
+    
+    OldGraph o = { .node_count = nodes, .edge_count = edges, .arena = g->arena, .arena_used = g->arena_used };
+    uint32_t *token_off = malloc(((uint64_t)nodes + 1) * sizeof(uint32_t));
+    uint16_t *token_len = malloc(((uint64_t)nodes + 1) * sizeof(uint16_t));
+    PackedEdge *kept = malloc(((uint64_t)edges + 1) * sizeof(PackedEdge));
+    int ok = token_off && token_len && kept;
+    if (ok) {
+        for (uint32_t i = 0; i < n; i++) {
+            if (id[i] == UINT32_MAX) continue;
+            token_off[id[i]] = g->token_off[i];
+            token_len[id[i]] = g->token_len[i];
+        }
+        
+        // Counting sort by new source; each row keeps insertion order, as the CSR does
+        memset(at, 0, ((uint64_t)n + 1) * sizeof(uint32_t));
+        for (uint32_t e = 0; e < m; e++) {
+            if (w[e] >= min_weight) at[id[g->edge_from[e]] + 1]++;
+        }
+        for (uint32_t i = 0; i < nodes; i++) at[i+1] += at[i];
+        for (uint32_t e = 0; e < m; e++) {
+            if (w[e] < min_weight) continue;
+            uint32_t from = id[g->edge_from[e]];
+            kept[at[from]++] = (PackedEdge){ .from = from, .to = id[g->edge_to[e]], .weight = w[e] };
+        }
+        memmove(at + 1, at, (uint64_t)nodes * sizeof(uint32_t));
+        at[0] = 0;
+        if (reorder) ok = reorder_bfs(nodes, at, token_off, token_len, kept);
+        o.token_off = token_off; o.token_len = token_len; o.edges = kept;
+    }
+    if (ok) ok = replace(g, &o);
+    free(id); free(w); free(at);
+    free(token_off); free(token_len); free(kept);
+    return ok;
+}
+
+/*
+ * Bulk load: a corpus file becomes part of the graph much faster than
+ * routing it line by line. Threads take a run of whole lines each and
+ * number their distinct tokens and token pairs in first-seen order; the
+ * runs are then merged in file order, so ids, edge order and weights come
+ * out as routing every line would leave them. They are appended in place
+ * without going through the log, and a checkpoint seals the result.
+ */
+typedef struct {
+    const uint8_t *p;       // Bytes in the corpus
+    uint32_t len, hash;
+} LoadToken;
+
+typedef struct {
+    uint32_t from, to;      // Local token ids in a run, global ids once merged
+    uint32_t count;         // Times one token followed the other (saturating);
+} LoadPair;                 // merged edges keep their weight here instead
+
+/* One thread's run of lines */
+typedef struct {
+    const char *begin, *end;
+    const uint8_t *delim;
+    LoadToken *tok;         // Local id -> token
+    uint32_t tokens, tok_room;
+    uint32_t *tok_slot;     // Token index: local id + 1, 0 = empty slot
+    uint32_t tok_cap;
+    LoadPair *pair;
+    uint32_t pairs, pair_room;
+    uint32_t *pair_slot;
+    uint32_t pair_cap;
+    int failed;             // Out of memory (or past ID_MAX): the load is off
+} LoadRun;
+
+/* Make room for one more of n elements in *p; 0 if impossible */
+int load_room(void **p, uint32_t n, uint32_t *room, size_t elem) {
+    if (n < *room) return 1;
+    if (n >= ID_MAX) return 0;
+    uint32_t cap = *room ? grow_cap(*room) : 1024;
+    void *grown = realloc(*p, (size_t)cap * elem);
+    if (!grown) return 0;
+    *p = grown;
+    *room = cap;
+    return 1;
+}
+
+/* An index of n entries sized for one more, rebuilt from their hashes
+ * (hash_of) when it doubles */
+int load_index(uint32_t **slot, uint32_t *cap, uint32_t n, uint32_t (*hash_of)(const void*, uint32_t),
+               const void *entries) {
+    if (2 * ((uint64_t)n + 1) <= *cap) return 1;
+    uint32_t grown = *cap ? *cap * 2 : HASH_MIN_CAP;
+    uint32_t *fresh = calloc(grown, sizeof(uint32_t));
+    if (!fresh || grown < *cap) { free(fresh); return 0; }
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t s = hash_of(entries, i) & (grown - 1);
+        while (fresh[s]) s = (s + 1) & (grown - 1);
+        fresh[s] = i + 1;
+    }
+    free(*slot);
+    *slot = fresh;
+    *cap = grown;
+    return 1;
+}
+
+uint32_t load_token_hash(const void *tokens, uint32_t i) {
+    return ((const LoadToken*)tokens)[i].hash;
+}
+
+uint32_t load_pair_hash(const void *pairs, uint32_t i) {
+    const LoadPair *p = (const LoadPair*)pairs + i;
+    return edge_hash(p->from, p->to);
+}
+
+/* Id of a token in tokens (adding it if new) through its index; UINT32_MAX
+ * if out of room */
+uint32_t load_intern(LoadToken **tok, uint32_t *tokens, uint32_t *room, uint32_t **slot, uint32_t *cap,
+                     LoadToken t) {
+    if (!load_index(slot, cap, *tokens, load_token_hash, *tok)) return UINT32_MAX;
+    uint32_t mask = *cap - 1, s = t.hash & mask;
+    for (; (*slot)[s]; s = (s + 1) & mask) {
+        LoadToken *x = &(*tok)[(*slot)[s] - 1];
+        if (x->hash == t.hash && x->len == t.len && memcmp(x->p, t.p, t.len) == 0) return (*slot)[s] - 1;
+    }
+    if (!load_room((void**)tok, *tokens, room, sizeof(LoadToken))) return UINT32_MAX;
+    (*tok)[*tokens] = t;
+    (*slot)[s] = ++*tokens;
+    return *tokens - 1;
+}
+
+/* Pair in pairs (adding it with count 0 if new); UINT32_MAX if out of room */
+uint32_t load_pair(LoadPair **pair, uint32_t *pairs, uint32_t *room, uint32_t **slot, uint32_t *cap,
+                   uint32_t from, uint32_t to) {
+    if (!load_index(slot, cap, *pairs, load_pair_hash, *pair)) return UINT32_MAX;
+    uint32_t mask = *cap - 1, s = edge_hash(from, to) & mask;
+    for (; (*slot)[s]; s = (s + 1) & mask) {
+        LoadPair *x = &(*pair)[(*slot)[s] - 1];
+        if (x->from == from && x->to == to) return (*slot)[s] - 1;
+    }
+    if (!load_room((void**)pair, *pairs, room, sizeof(LoadPair))) return UINT32_MAX;
+    (*pair)[*pairs] = (LoadPair){ from, to, 0 };
+    (*slot)[s] = ++*pairs;
+    return *pairs - 1;
+}
+
+/* Tokenize a run the way stream_feed() does: separators end tokens, a
+ * newline also ends the line, long tokens are cut every TOKEN_MAX bytes */
+void *load_worker(void *arg) {
+    LoadRun *r = arg;
+    uint32_t last = UINT32_MAX;
+    const char *start = r->begin;
+    for (const char *c = r->begin; c <= r->end && !r->failed; c++) {
+        if (c < r->end && !r->delim[(uint8_t)*c]) continue;
+        for (const char *t = start; t < c; t += TOKEN_MAX) {
+            uint32_t len = c - t < TOKEN_MAX ? c - t : TOKEN_MAX;
+            LoadToken tok = { (const uint8_t*)t, len, token_hash((const uint8_t*)t, len) };
+            uint32_t id = load_intern(&r->tok, &r->tokens, &r->tok_room, &r->tok_slot, &r->tok_cap, tok);
+            if (id == UINT32_MAX) { r->failed = 1; break; }
+            if (last != UINT32_MAX && last != id) {
+                uint32_t p = load_pair(&r->pair, &r->pairs, &r->pair_room, &r->pair_slot, &r->pair_cap, last, id);
+                if (p == UINT32_MAX) { r->failed = 1; break; }
+                if (r->pair[p].count < UINT32_MAX) r->pair[p].count++;
+            }
+            last = id;
+        }
+        if (c == r->end || *c == '\n') last = UINT32_MAX;
+        start = c + 1;
+    }
+    free(r->tok_slot);
+    free(r->pair_slot);
+    r->tok_slot = r->pair_slot = NULL;
+    return NULL;
+}
+
+/* A weight after create_edge() bumped it times more */
+uint8_t weight_bumped(uint8_t w, uint32_t times) {
+    for (; times && w < 255; times--) w = w < 240 ? w + 15 : 255;
+    return w;
+}
+
+/* Load a corpus with up to threads threads (0: one per core); the graph's
+ * own nodes and edges come first, as if it had routed every line */
+int bulk_load(Graph *g, const char *path, uint32_t threads) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        fprintf(stderr, "melvin: cannot read %s\n", path);
+        return 0;
+    }
+    size_t size = st.st_size;
+    const char *text = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+    if (text == MAP_FAILED) {
+        fprintf(stderr, "melvin: cannot map %s\n", path);
+        return 0;
+    }
+    if (size) madvise((void*)text, size, MADV_SEQUENTIAL);
+    
+    // Runs of whole lines, a MiB or more each
+    if (!threads) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n < 1 ? 1 : (uint32_t)n;
+    }
+    if (threads > LOAD_MAX_THREADS) threads = LOAD_MAX_THREADS;
+    if (threads > size / LOAD_MIN_RUN + 1) threads = size / LOAD_MIN_RUN + 1;
+    LoadRun run[LOAD_MAX_THREADS] = {{0}};
+    pthread_t thread[LOAD_MAX_THREADS];
+    const char *at = text, *end = text + size;
+    for (uint32_t i = 0; i < threads; i++) {
+        const char *stop = i + 1 == threads ? end : text + size / threads * (i + 1);
+        if (stop < at) stop = at;
+        while (stop > text && stop < end && stop[-1] != '\n') stop++;
+        run[i] = (LoadRun){ .begin = at, .end = stop, .delim = g->delim };
+        at = stop;
+    }
+    uint32_t started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&thread[started], NULL, load_worker, &run[started]) != 0) break;
+    }
+    for (uint32_t i = started; i < threads; i++) load_worker(&run[i]);
+    for (uint32_t i = 0; i < started; i++) pthread_join(thread[i], NULL);
+    
+    // Merge in file order: ids past the graph's go to tokens it lacks, in
+    // the order their runs met them; pairs likewise
+    sync_header(g);
+    uint32_t n = g->node_count, m = g->edge_count;
+    LoadToken *fresh = NULL;
+    uint32_t fresh_count = 0, fresh_room = 0, *fresh_slot = NULL, fresh_slot_cap = 0;
+    LoadPair *edge = NULL;
+    uint32_t edge_count = 0, edge_room = 0, *edge_slot = NULL, edge_slot_cap = 0;
+    uint8_t *w = malloc(m ? m : 1);
+    uint32_t *id = NULL;
+    uint64_t arena = g->arena_used;
+    int ok = w != NULL;
+    if (ok) memcpy(w, g->edge_w, m);
+    for (uint32_t r = 0; r < threads; r++) ok = ok && !run[r].failed;
+    for (uint32_t r = 0; ok && r < threads; r++) {
+        LoadRun *lr = &run[r];
+        uint32_t *grown = realloc(id, ((size_t)lr->tokens + 1) * sizeof(uint32_t));
+        if (!(ok = grown != NULL)) break;
+        id = grown;
+        for (uint32_t i = 0; ok && i < lr->tokens; i++) {
+            LoadToken t = lr->tok[i];
+            id[i] = find_node(g, (uint8_t*)t.p, t.len);
+            if (id[i] != UINT32_MAX) continue;
+            uint32_t before = fresh_count;
+            uint32_t k = load_intern(&fresh, &fresh_count, &fresh_room, &fresh_slot, &fresh_slot_cap, t);
+            ok = k != UINT32_MAX && (uint64_t)n + fresh_count <= ID_MAX;
+            id[i] = n + k;
+            if (fresh_count > before) arena += t.len;
+        }
+        for (uint32_t i = 0; ok && i < lr->pairs; i++) {
+            LoadPair p = lr->pair[i];
+            uint32_t from = id[p.from], to = id[p.to];
+            uint32_t e = from < n && to < n ? find_edge(g, from, to) : UINT32_MAX;
+            if (e != UINT32_MAX) {
+                w[e] = weight_bumped(w[e], p.count);
+                continue;
+            }
+            uint32_t before = edge_count;
+            uint32_t k = load_pair(&edge, &edge_count, &edge_room, &edge_slot, &edge_slot_cap, from, to);
+            if (!(ok = k != UINT32_MAX && (uint64_t)m + edge_count <= ID_MAX)) break;
+            // New: created at 100, then bumped by every later sighting
+            uint32_t bumps = p.count - (edge_count > before);
+            edge[k].count = edge_count > before ? weight_bumped(100, bumps) : weight_bumped(edge[k].count, bumps);
+        }
+        free(lr->tok);
+        free(lr->pair);
+        lr->tok = NULL;
+        lr->pair = NULL;
+    }
+    free(fresh_slot);
+    free(edge_slot);
+    if (ok && arena > ID_MAX) {
+        fprintf(stderr, "melvin: %s: more token bytes than a graph holds\n", path);
+        ok = 0;
+    }
+    
+    // Room for all of it at once, then in place: swapping in a new file
+    // would strand processes waiting for the lock on the old one
+    uint32_t nodes = n + fresh_count, edges = m + edge_count;
+    if (ok) {
+        uint32_t node_cap = g->node_cap, edge_cap = g->edge_cap, arena_cap = g->arena_cap;
+        uint32_t hash_cap = g->hash_cap, ehash_cap = g->ehash_cap;
+        while (node_cap < nodes) node_cap = grow_cap(node_cap);
+        while (edge_cap < edges) edge_cap = grow_cap(edge_cap);
+        while (arena_cap < arena) arena_cap = grow_cap(arena_cap);
+        while (hash_cap < 2 * (uint64_t)nodes) hash_cap *= 2;
+        while (ehash_cap < 2 * (uint64_t)edges) ehash_cap *= 2;
+        if (node_cap != g->node_cap || edge_cap != g->edge_cap || arena_cap != g->arena_cap ||
+            hash_cap != g->hash_cap || ehash_cap != g->ehash_cap) {
+            ok = reserve(g, node_cap, edge_cap, hash_cap, ehash_cap, arena_cap);
+        }
+    }
+    if (ok) {
+        // Not logged: the checkpoint below publishes it all. A crash before
+        // it keeps the graph as it was, bar some weights already raised.
+        unseal(g);
+        for (uint32_t i = 0; i < fresh_count; i++) node_append(g, fresh[i].p, fresh[i].len, 0);
+        for (uint32_t e = 0; e < m; e++) {
+            if (w[e] != g->edge_w[e]) edge_weigh(g, e, w[e], 0);
+        }
+        for (uint32_t e = 0; e < edge_count; e++) edge_append(g, edge[e].from, edge[e].to, edge[e].count, 0);
+        checkpoint(g);
+    }
+    
+    for (uint32_t r = 0; r < threads; r++) { free(run[r].tok); free(run[r].pair); }
+    free(fresh); free(edge); free(w); free(id);
+    if (size) munmap((void*)text, size);
+    return ok;
+}
+
+/* Log of a graph file: foo.mmap keeps its changes in foo.log */
+void log_path_for(char *out, size_t cap, const char *path) {
+    size_t len = strlen(path);
+    if (len > 5 && strcmp(path + len - 5, ".mmap") == 0) {
+        snprintf(out, cap, "%.*s.log", (int)(len - 5), path);
+    } else {
+        snprintf(out, cap, "%s.log", path);
+    }
+}
+
+/* Changes logged since the last checkpoint? */
+int unsaved(Graph *g) {
+    return g->log_fd >= 0 && (g->log_len || g->log_size > sizeof(LogHeader));
+}
+
+/* Open a graph file and its log without seeding an empty one */
+Graph *graph_open(const char *path, int flags) {
+    if (strlen(path) + 5 > PATH_MAX) return NULL;   // Room for ".tmp"
+    Graph *m = calloc(1, sizeof(Graph));
+    if (!m) return NULL;
+    strcpy(m->path, path);
+    log_path_for(m->log_path, sizeof(m->log_path), path);
+    pthread_mutex_init(&m->write_lock, NULL);
+    pthread_mutex_init(&m->pool_lock, NULL);
+    pthread_mutex_init(&m->cache.lock, NULL);
+    m->cache.cap = CACHE_ENTRIES;
+    m->fd = m->log_fd = -1;
+    m->delim[' '] = m->delim['\n'] = 1;
+    
+    int ok = (flags & MELVIN_READONLY) ? load_readonly(m, flags & MELVIN_PEEK) : load(m, flags & MELVIN_RECOVER);
+    if (!ok) {
+        if (m->map) unload(m);
+        pthread_mutex_destroy(&m->write_lock);
+        pthread_mutex_destroy(&m->pool_lock);
+        pthread_mutex_destroy(&m->cache.lock);
+        free(m);
+        return NULL;
+    }
+    return m;
+}
+
+Melvin *melvin_open(const char *path, int flags) {
+    Graph *m = graph_open(path, flags);
+    if (!m) return NULL;
+    if (m->hdr->shard_count) {
+        fprintf(stderr, "melvin: %s is shard %u of %u; open the set with melvin_shards_open()\n",
+                path, m->hdr->shard, m->hdr->shard_count);
+        melvin_close(m);
+        return NULL;
+    }
+    if (m->node_count == 0 && !m->readonly) init(m);
+    return m;
+}
+
+void melvin_close(Melvin *m) {
+    if (!m) return;
+    if (unsaved(m)) save(m);
+    unload(m);
+    cache_clear(&m->cache);
+    if (m->pool) {
+        pool_stop(m->pool);
+        free(m->pool);
+    }
+    pthread_mutex_destroy(&m->write_lock);
+    pthread_mutex_destroy(&m->pool_lock);
+    pthread_mutex_destroy(&m->cache.lock);
+    free(m);
+}
+
+/* The calling thread's output stream for a library call, emptied; it
+ * keeps its buffer, so only a longer output than before allocates */
+FILE *sink_begin(Scratch *sc) {
+    if (!sc->sink && !(sc->sink = open_memstream(&sc->sink_text, &sc->sink_len))) return NULL;
+    rewind(sc->sink);
+    return sc->sink;
+}
+
+/* Bytes printed into the sink since sink_begin(), -1 on a write error */
+long sink_size(Scratch *sc) {
+    return fflush(sc->sink) == 0 && !ferror(sc->sink) ? ftell(sc->sink) : -1;
+}
+
+/* Copy what a walk printed into the caller's buffer; its full length */
+int take_output(Scratch *sc, char *out, size_t cap) {
+    long len = sink_size(sc);
+    if (len < 0) return -1;
+    if (cap) {
+        size_t n = (size_t)len < cap - 1 ? (size_t)len : cap - 1;
+        memcpy(out, sc->sink_text, n);
+        out[n] = '\0';
+    }
+    return len > INT_MAX ? INT_MAX : (int)len;
+}
+
+/* Write what a walk printed into the sink to out */
+void send_output(Scratch *sc, FILE *out) {
+    long len = sink_size(sc);
+    if (len < 0) fprintf(out, "ERROR\n");
+    else fwrite(sc->sink_text, 1, len, out);
+}
+
+int melvin_route(Melvin *m, const char *line, char *out, size_t cap) {
+    if (!m || m->readonly) return -1;
+    FILE *f = sink_begin(&scratch);
+    if (!f) return -1;
+    pthread_mutex_lock(&m->write_lock);
+    route(m, line, f);
+    pthread_mutex_unlock(&m->write_lock);
+    return take_output(&scratch, out, cap);
+}
+
+int melvin_query(Melvin *m, const char *line, char *out, size_t cap) {
+    if (!m) return -1;
+    FILE *f = sink_begin(&scratch);
+    if (!f) return -1;
+    int slot = reader_enter(m);
+    query(m, line, f);
+    reader_exit(m, slot);
+    return take_output(&scratch, out, cap);
+}
+
+/* Routes and queries read a handle's walk and delimiters without a lock:
+ * change them with routes excluded and every reader held out */
+void settings_begin(Melvin *m) {
+    pthread_mutex_lock(&m->write_lock);
+    __atomic_store_n(&m->gate, 1, __ATOMIC_SEQ_CST);
+    synchronize(m);
+}
+
+void settings_end(Melvin *m) {
+    __atomic_store_n(&m->gate, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&m->write_lock);
+}
+
+void melvin_set_walk(Melvin *m, const MelvinWalk *w) {
+    settings_begin(m);
+    m->walk = w ? *w : (Walk){0};
+    settings_end(m);
+}
+
+void melvin_set_cache(Melvin *m, uint32_t entries) {
+    if (entries > CACHE_MAX) entries = CACHE_MAX;
+    pthread_mutex_lock(&m->cache.lock);
+    cache_clear(&m->cache);
+    STORE(m->cache.cap, entries);
+    pthread_mutex_unlock(&m->cache.lock);
+}
+
+/* Newline always ends a line; it stays a separator too */
+void delim_set(Melvin *m, const char *delim) {
+    memset(m->delim, 0, sizeof(m->delim));
+    m->delim['\n'] = 1;
+    for (const char *d = delim; *d; d++) m->delim[(uint8_t)*d] = 1;
+}
+
+void melvin_set_delim(Melvin *m, const char *delim) {
+    settings_begin(m);
+    delim_set(m, delim);
+    settings_end(m);
+}
+
+int melvin_save(Melvin *m) {
+    if (m->readonly) return -1;
+    pthread_mutex_lock(&m->write_lock);
+    save(m);
+    pthread_mutex_unlock(&m->write_lock);
+    return 0;
+}
+
+int melvin_checkpoint(Melvin *m) {
+    if (m->readonly) return -1;
+    pthread_mutex_lock(&m->write_lock);
+    checkpoint(m);
+    pthread_mutex_unlock(&m->write_lock);
+    return 0;
+}
+
+int melvin_compact(Melvin *m, unsigned decay, uint8_t min_weight, int reorder) {
+    if (m->readonly) return -1;
+    pthread_mutex_lock(&m->write_lock);
+    int ok = compact(m, decay, min_weight, reorder);
+    pthread_mutex_unlock(&m->write_lock);
+    return ok ? 0 : -1;
+}
+
+int melvin_load(Melvin *m, const char *corpus, uint32_t threads) {
+    if (m->readonly) return -1;
+    pthread_mutex_lock(&m->write_lock);
+    int ok = bulk_load(m, corpus, threads);
+    pthread_mutex_unlock(&m->write_lock);
+    return ok ? 0 : -1;
+}
+
+uint32_t melvin_node_count(Melvin *m) {
+    return LOAD(m->node_count);
+}
+
+uint32_t melvin_edge_count(Melvin *m) {
+    return LOAD(m->edge_count);
+}
+
+const char *melvin_token(Melvin *m, uint32_t id, uint32_t *len) {
+    // A damaged file may point anywhere; stay inside the arena
+    if (id >= LOAD(m->node_count) ||
+        (uint64_t)m->token_off[id] + m->token_len[id] > m->arena_used) return NULL;
+    *len = m->token_len[id];
+    return (const char*)m->arena + m->token_off[id];
+}
+
+int32_t melvin_value(Melvin *m, uint32_t id) {
+    return id < LOAD(m->node_count) ? m->value[id] : 0;
+}
+
+uint32_t melvin_find_value(Melvin *m, int32_t value) {
+    if (!m) return UINT32_MAX;
+    int slot = reader_enter(m);
+    uint32_t id = find_value(m, value);
+    reader_exit(m, slot);
+    return id;
+}
+
+int melvin_edge(Melvin *m, uint32_t e, uint32_t *from, uint32_t *to, uint8_t *weight) {
+    if (e >= LOAD(m->edge_count)) return 0;
+    *from = m->edge_from[e];
+    *to = m->edge_to[e];
+    *weight = RELAXED(m->edge_w[e]);
+    return 1;
+}
+
+int melvin_verify(Melvin *m, uint64_t *bad) {
+    *bad = 0;
+    // Section CRCs only mean something on a sealed file nobody is writing
+    if (!m->locked && flock(m->fd, LOCK_SH | LOCK_NB) != 0) return MELVIN_BUSY;
+    int result = MELVIN_OK;
+    if (!(m->hdr->flags & F_SEALED) || (!m->readonly && unsaved(m))) {
+        result = MELVIN_UNSEALED;
+    } else if ((*bad = section_errors(m))) {
+        result = MELVIN_CORRUPT;
+    }
+    if (!m->locked) flock(m->fd, LOCK_UN);
+    return result;
+}
+
+/*
+ * Shards: one graph split over N files by token hash, melvin.mmap becoming
+ * melvin.0.mmap .. melvin.<N-1>.mmap, each with its own log and lock. A
+ * node lives in the shard its token hashes to. An edge lives with its
+ * source; a target owned by another shard gets a stub there (a node with
+ * the same token that never has edges of its own). Walks run level by
+ * level over (shard, node) pairs and hop to the owner whenever they reach
+ * a stub, so they visit the same nodes in the same order as one graph.
+ */
+#define SHARD_MAX 64
+
+typedef struct {
+    uint32_t shard, id;
+} ShardNode;
+
+typedef struct MelvinShards {
+    uint32_t count;
+    Graph *shard[SHARD_MAX];
+    Walk walk;
+    pthread_mutex_t write_lock;     // Routes one at a time; queries never wait
+} Shards;
+
+__thread ShardNode *line_nodes;     // Tokens of the current line, see shard_push()
+__thread uint32_t line_len, line_nodes_cap;
+__thread int line_keep;
+__thread ShardNode *shard_queue;    // Visit order of a sharded walk
+__thread uint32_t shard_queue_cap;
+__thread ShardNode *shard_starts;   // A line's starts plus what its rule points to
+__thread uint32_t shard_starts_cap;
+__thread Scratch shard_marks[SHARD_MAX];   // Visited stamps, one set per shard
+
+/* Shard owning a token: its hash, mixed so the shard doesn't pick the
+ * index slot bits, scaled to the count */
+uint32_t shard_of(const Shards *sh, const uint8_t *token, uint32_t len) {
+    uint32_t h = token_hash(token, len) * 0x9E3779B1u;
+    return (uint32_t)(((uint64_t)(h ^ h >> 16) * sh->count) >> 32);
+}
+
+/* Remember a resolved token; its index stands in for the id in the
+ * stream. Only the latest two are needed unless the walk starts from all. */
+uint32_t shard_push(uint32_t shard, uint32_t id) {
+    uint32_t i = line_keep ? line_len : line_len & 1;
+    if (i >= line_nodes_cap) {
+        uint32_t cap = line_nodes_cap ? line_nodes_cap * 2 : 64;
+        ShardNode *nodes = realloc(line_nodes, cap * sizeof(ShardNode));
+        if (!nodes) {
+            fprintf(stderr, "melvin: out of memory for line tokens\n");
+            return UINT32_MAX;
+        }
+        line_nodes = nodes;
+        line_nodes_cap = cap;
+    }
+    line_nodes[i] = (ShardNode){ shard, id };
+    line_len++;
+    return i;
+}
+
+/* Stream resolvers (ctx: the set): the token's node in its own shard */
+uint32_t shard_create(void *ctx, uint8_t *token, uint32_t len) {
+    Shards *sh = ctx;
+    uint32_t s = shard_of(sh, token, len);
+    uint32_t id = find_or_create(sh->shard[s], token, len);
+    return id == UINT32_MAX ? UINT32_MAX : shard_push(s, id);
+}
+
+uint32_t shard_find(void *ctx, uint8_t *token, uint32_t len) {
+    Shards *sh = ctx;
+    uint32_t s = shard_of(sh, token, len);
+    uint32_t id = find_node(sh->shard[s], token, len);
+    return id == UINT32_MAX ? UINT32_MAX : shard_push(s, id);
+}
+
+/* Token bytes of a node in any shard */
+uint8_t *shard_token(const Shards *sh, ShardNode n, uint32_t *len) {
+    Graph *sg = sh->shard[n.shard];
+    *len = sg->token_len[n.id];
+    return sg->arena + sg->token_off[n.id];
+}
+
+/* Edge stored in the source's shard; a target owned elsewhere is
+ * reached through its stub there */
+void shard_connect(Shards *sh, ShardNode from, ShardNode to, uint8_t weight) {
+    uint32_t len;
+    uint8_t *token = shard_token(sh, to, &len);
+    Graph *sg = sh->shard[from.shard];
+    uint32_t to_id = to.shard == from.shard ? to.id : find_or_create(sg, token, len);
+    if (to_id != UINT32_MAX) create_edge(sg, from.id, to_id, weight);
+}
+
+void shard_link(void *ctx, uint32_t from, uint32_t to) {
+    shard_connect(ctx, line_nodes[from], line_nodes[to], 100);
+}
+
+/* Sharded breadth-first walk from starts; shard_queue gets the distinct
+ * starts (*sources of them), then the nodes reached. Bounds as in
+ * walk_bfs(), without top-K. Returns how many in all. */
+uint32_t shard_walk(const Shards *sh, const ShardNode *starts, uint32_t n, const Walk *w, uint32_t *sources) {
+    uint64_t t = STAT_NOW();
+    View views[SHARD_MAX];
+    uint64_t total = 0;
+    for (uint32_t s = 0; s < sh->count; s++) {
+        views[s] = view_begin(sh->shard[s]);
+        if (!scratch_begin(&shard_marks[s], views[s].node_count)) return 0;
+        total += views[s].node_count;
+    }
+    
+    // Every entry is a distinct node that is not a stub
+    uint32_t limit = w->max_visited ? w->max_visited : UINT32_MAX;
+    uint64_t need = total < limit ? total : limit;
+    if (need < n) need = n;
+    if (shard_queue_cap < need) {
+        ShardNode *queue = realloc(shard_queue, need * sizeof(ShardNode));
+        if (!queue) return 0;
+        shard_queue = queue;
+        shard_queue_cap = need;
+    }
+    
+    uint32_t q_end = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        ShardNode x = starts[i];
+        Scratch *m = &shard_marks[x.shard];
+        if (m->mark[x.id] == m->gen) continue;
+        m->mark[x.id] = m->gen;
+        shard_queue[q_end++] = x;
+    }
+    *sources = q_end;
+    
+    uint32_t q_start = 0, depth = 0;
+    uint64_t edges = 0;
+    while (q_start < q_end && q_end < limit && !(w->max_depth && depth >= w->max_depth)) {
+        uint32_t level_end = q_end;
+        STAT_MAX(frontier_max, level_end - q_start);
+        while (q_start < level_end && q_end < limit) {
+            ShardNode current = shard_queue[q_start++];
+            Graph *sg = sh->shard[current.shard];
+            View *v = &views[current.shard];
+            Scratch *m = &shard_marks[current.shard];
+            Cursor it = out_edges(v, current.id, w->min_weight);
+            uint32_t target;
+            uint8_t weight;
+            while (q_end < limit && next_edge(v, &it, &target, &weight)) {
+                edges++;
+                if (m->mark[target] == m->gen) continue;
+                m->mark[target] = m->gen;
+                ShardNode next = { current.shard, target };
+                uint32_t len = sg->token_len[target];
+                uint8_t *token = sg->arena + sg->token_off[target];
+                uint32_t owner = shard_of(sh, token, len);
+                if (owner != current.shard) {
+                    // A stub: go on from the node itself
+                    next = (ShardNode){ owner, find_node(sh->shard[owner], token, len) };
+                    Scratch *om = &shard_marks[owner];
+                    if (next.id >= views[owner].node_count || om->mark[next.id] == om->gen) continue;
+                    om->mark[next.id] = om->gen;
+                }
+                shard_queue[q_end++] = next;
+            }
+        }
+        q_start = level_end;
+        depth++;
+    }
+    STAT_ADD(walk_levels, depth);
+    STAT_ADD(walk_edges, edges);
+    STAT_ADD(walks, 1);
+    STAT_ADD(walk_visited, q_end);
+    STAT_ADD(walk_ns, STAT_NOW() - t);
+    return q_end;
+}
+
+/* Start a sharded line: learn links each token to the one before it */
+void shards_begin(Shards *sh, Stream *st, int learn) {
+    line_len = 0;
+    line_keep = sh->walk.spread;
+    // Every shard has the same separators
+    stream_begin(st, sh, sh->shard[0]->delim, learn ? shard_create : shard_find, learn ? shard_link : NULL,
+                 line_keep);
+}
+
+/* Add one start to shard_starts, growing it; 0 if out of memory */
+int shard_start(uint32_t i, ShardNode x) {
+    if (i >= shard_starts_cap) {
+        uint32_t cap = shard_starts_cap ? shard_starts_cap * 2 : 64;
+        ShardNode *starts = realloc(shard_starts, cap * sizeof(ShardNode));
+        if (!starts) return 0;
+        shard_starts = starts;
+        shard_starts_cap = cap;
+    }
+    shard_starts[i] = x;
+    return 1;
+}
+
+/* rule_starts() for a sharded line: the line tokens at idx, then the
+ * targets of the rule for count-token lines. The rule node is registered
+ * in the shard owning its token; targets owned elsewhere are stubs there. */
+const ShardNode *shard_rule_starts(const Shards *sh, const uint32_t *idx, uint32_t *n, uint32_t count) {
+    uint32_t len = 0;
+    for (uint32_t i = 0; i < *n; i++) {
+        if (!shard_start(len++, line_nodes[idx[i]])) return NULL;
+    }
+    
+    char name[32];
+    int name_len = snprintf(name, sizeof(name), "rule_%utoken", count);
+    uint32_t s = shard_of(sh, (uint8_t*)name, name_len);
+    Graph *sg = sh->shard[s];
+    uint32_t rule = rule_for(sg, count);
+    if (rule != UINT32_MAX) {
+        View v = view_begin(sg);
+        Cursor it = out_edges(&v, rule, sh->walk.min_weight);
+        uint32_t target, token_len;
+        uint8_t weight;
+        while (next_edge(&v, &it, &target, &weight)) {
+            ShardNode x = { s, target };
+            uint8_t *token = shard_token(sh, x, &token_len);
+            x.shard = shard_of(sh, token, token_len);
+            if (x.shard != s) x.id = find_node(sh->shard[x.shard], token, token_len);
+            if (x.id == UINT32_MAX) continue;
+            if (!shard_start(len++, x)) return NULL;
+        }
+    }
+    *n = len;
+    return shard_starts;
+}
+
+uint8_t *shard_walk_token(void *ctx, const Scratch *sc, uint32_t v, uint32_t *len) {
+    (void)sc;
+    return shard_token(ctx, shard_queue[v], len);
+}
+
+/* route_end()/query_end() for a sharded line */
+int shards_end(Shards *sh, Stream *st, FILE *out, int learn) {
+    stream_flush(st);
+    if (st->count == 0) return 0;
+    for (uint32_t s = 0; learn && s < sh->count; s++) {
+        if (csr_stale(sh->shard[s])) csr_rebuild(sh->shard[s]);
+    }
+    
+    uint32_t n, sources;
+    const uint32_t *idx = stream_starts(st, &n);
+    const ShardNode *starts = shard_rule_starts(sh, idx, &n, st->count);
+    uint32_t reached = starts ? shard_walk(sh, starts, n, &sh->walk, &sources) : 0;
+    if (!out || !reached) return st->count;
+    size_t len = walk_text(&scratch, reached, sources, 0, shard_walk_token, sh);
+    if (len) fwrite(scratch.text, 1, len, out);
+    else fprintf(stderr, "melvin: out of memory for walk output\n");
+    return st->count;
+}
+
+/* Every shard: log_commit(1) or checkpoint() */
+void shards_sync(Shards *sh, int full) {
+    for (uint32_t s = 0; s < sh->count; s++) {
+        if (full) checkpoint(sh->shard[s]);
+        else log_commit(sh->shard[s], 1);
+    }
+}
+
+/* batch() for shards; one line only unless batched */
+void shards_batch(Shards *sh, FILE *in, FILE *out, int readonly, unsigned long every, int batched) {
+    Stream st = {0};
+    unsigned long lines = 0;
+    for (;;) {
+        shards_begin(sh, &st, !readonly);
+        if (!stream_line(&st, in)) break;
+        shards_end(sh, &st, out, !readonly);
+        lines++;
+        if (!batched) break;
+        if (readonly) continue;
+        if (every && lines % every == 0) shards_sync(sh, 1);
+        else if (lines % LOG_SYNC_LINES == 0) shards_sync(sh, 0);
+    }
+    stream_free(&st);
+}
+
+/* Shard i's file: foo.mmap -> foo.<i>.mmap */
+void shard_path_for(char *out, size_t cap, const char *path, uint32_t i) {
+    size_t len = strlen(path);
+    if (len > 5 && strcmp(path + len - 5, ".mmap") == 0) len -= 5;
+    snprintf(out, cap, "%.*s.%u.mmap", (int)len, path, i);
+}
+
+void melvin_shards_close(MelvinShards *sh) {
+    if (!sh) return;
+    for (uint32_t s = 0; s < sh->count; s++) melvin_close(sh->shard[s]);
+    for (uint32_t s = 0; s < SHARD_MAX; s++) scratch_free(&shard_marks[s]);
+    free(shard_queue);
+    free(shard_starts);
+    free(line_nodes);
+    shard_queue = shard_starts = line_nodes = NULL;
+    shard_queue_cap = shard_starts_cap = line_nodes_cap = 0;
+    pthread_mutex_destroy(&sh->write_lock);
+    free(sh);
+}
+
+MelvinShards *melvin_shards_open(const char *path, uint32_t count, int flags) {
+    if (count == 0 || count > SHARD_MAX) {
+        fprintf(stderr, "melvin: a sharded graph has 1 to %d shards\n", SHARD_MAX);
+        return NULL;
+    }
+    Shards *sh = calloc(1, sizeof(Shards));
+    if (!sh) return NULL;
+    pthread_mutex_init(&sh->write_lock, NULL);
+    
+    // New files are stamped with their place in the set; old ones must match it
+    uint32_t fresh = 0;
+    char p[PATH_MAX];
+    for (uint32_t s = 0; s < count; s++) {
+        shard_path_for(p, sizeof(p), path, s);
+        Graph *m = graph_open(p, flags);
+        if (!m) break;
+        sh->shard[sh->count++] = m;
+        if (m->hdr->shard_count == 0 && m->node_count == 0 && !m->readonly) {
+            fresh++;
+        } else if (m->hdr->shard != s || m->hdr->shard_count != count) {
+            if (m->hdr->shard_count) {
+                fprintf(stderr, "melvin: %s is shard %u of %u\n", p, m->hdr->shard, m->hdr->shard_count);
+            } else {
+                fprintf(stderr, "melvin: %s is not a shard\n", p);
+            }
+            break;
+        }
+    }
+    if (sh->count == count && fresh && fresh != count) {
+        // Don't leave empty stand-ins for the lost ones behind
+        fprintf(stderr, "melvin: shards of %s are missing\n", path);
+        for (uint32_t s = 0; s < count; s++) {
+            Graph *m = sh->shard[s];
+            if (m->hdr->shard_count || m->node_count) continue;
+            unlink(m->path);
+            unlink(m->log_path);
+        }
+    } else if (sh->count == count) {
+        if (fresh) {
+            for (uint32_t s = 0; s < count; s++) {
+                Graph *sg = sh->shard[s];
+                sg->hdr->shard = s;
+                sg->hdr->shard_count = count;
+                sync_header(sg);
+            }
+            
+            // Seed the set as init() seeds one graph, then seal every file
+            line_keep = 0;
+            for (int i = 0; i < 8; i++) {
+                line_len = 0;
+                uint32_t a = shard_create(sh, (uint8_t*)init_patterns[i][0], strlen(init_patterns[i][0]));
+                uint32_t b = shard_create(sh, (uint8_t*)init_patterns[i][1], strlen(init_patterns[i][1]));
+                if (a != UINT32_MAX && b != UINT32_MAX) shard_connect(sh, line_nodes[a], line_nodes[b], 255);
+            }
+            shards_sync(sh, 1);
+        }
+        return sh;
+    }
+    melvin_shards_close(sh);    // The shards opened so far
+    return NULL;
+}
+
+int melvin_shards_route(MelvinShards *sh, const char *line, char *out, size_t cap) {
+    if (!sh || sh->shard[0]->readonly) return -1;
+    FILE *f = sink_begin(&scratch);
+    if (!f) return -1;
+    pthread_mutex_lock(&sh->write_lock);
+    shards_begin(sh, &scratch.line, 1);
+    stream_feed(&scratch.line, line, strlen(line));
+    shards_end(sh, &scratch.line, f, 1);
+    pthread_mutex_unlock(&sh->write_lock);
+    return take_output(&scratch, out, cap);
+}
+
+int melvin_shards_query(MelvinShards *sh, const char *line, char *out, size_t cap) {
+    if (!sh) return -1;
+    FILE *f = sink_begin(&scratch);
+    if (!f) return -1;
+    int slots[SHARD_MAX];
+    for (uint32_t s = 0; s < sh->count; s++) slots[s] = reader_enter(sh->shard[s]);
+    shards_begin(sh, &scratch.line, 0);
+    stream_feed(&scratch.line, line, strlen(line));
+    shards_end(sh, &scratch.line, f, 0);
+    for (uint32_t s = 0; s < sh->count; s++) reader_exit(sh->shard[s], slots[s]);
+    return take_output(&scratch, out, cap);
+}
+
+/* Like settings_begin() for the whole set: routes take sh->write_lock,
+ * queries enter every shard */
+void shards_settings_begin(MelvinShards *sh) {
+    pthread_mutex_lock(&sh->write_lock);
+    for (uint32_t s = 0; s < sh->count; s++) settings_begin(sh->shard[s]);
+}
+
+void shards_settings_end(MelvinShards *sh) {
+    for (uint32_t s = 0; s < sh->count; s++) settings_end(sh->shard[s]);
+    pthread_mutex_unlock(&sh->write_lock);
+}
+
+void melvin_shards_set_walk(MelvinShards *sh, const MelvinWalk *w) {
+    shards_settings_begin(sh);
+    sh->walk = w ? *w : (Walk){0};
+    sh->walk.top_k = 0;
+    shards_settings_end(sh);
+}
+
+void melvin_shards_set_delim(MelvinShards *sh, const char *delim) {
+    shards_settings_begin(sh);
+    for (uint32_t s = 0; s < sh->count; s++) delim_set(sh->shard[s], delim);
+    shards_settings_end(sh);
+}
+
+int melvin_shards_checkpoint(MelvinShards *sh) {
+    if (sh->shard[0]->readonly) return -1;
+    pthread_mutex_lock(&sh->write_lock);
+    shards_sync(sh, 1);
+    pthread_mutex_unlock(&sh->write_lock);
+    return 0;
+}
+
+/* Server: one thread per client, one response line per request */
+typedef struct {
+    Graph *graph;
+    int fd;
+    pthread_t thread;
+    int done;
+} Client;
+
+volatile sig_atomic_t stop;
+
+void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+/* Handle one request line; returns 0 to drop the client */
+int serve_line(Graph *g, char *line, FILE *out) {
+    if (strcmp(line, "!QUIT") == 0) return 0;
+    
+    if (strcmp(line, "!SAVE") == 0) {
+        pthread_mutex_lock(&g->write_lock);
+        checkpoint(g);
+        pthread_mutex_unlock(&g->write_lock);
+        fprintf(out, "OK\n");
+    } else if (strncmp(line, "!QUERY ", 7) == 0) {
+        // Readers never take the writer lock; they only pin an epoch, and
+        // not while the client reads: a stalled one would hold up synchronize()
+        FILE *text = sink_begin(&scratch);
+        if (!text) return fprintf(out, "ERROR\n") >= 0 && fflush(out) == 0;
+        int slot = reader_enter(g);
+        if (query(g, line + 7, text) == 0) fputc('\n', text);
+        reader_exit(g, slot);
+        send_output(&scratch, out);
+    } else if (strncmp(line, "!COMPACT", 8) == 0 && (line[8] == '\0' || line[8] == ' ')) {
+        // "!COMPACT [decay [min_weight [reorder]]]"
+        unsigned long decay = 0, min_weight = 1, reorder = 0;
+        sscanf(line + 8, "%lu %lu %lu", &decay, &min_weight, &reorder);
+        pthread_mutex_lock(&g->write_lock);
+        uint32_t nodes = g->node_count, edges = g->edge_count;
+        if (compact(g, decay, min_weight > 255 ? 255 : min_weight, reorder != 0)) {
+            fprintf(out, "OK nodes %u -> %u, edges %u -> %u\n", nodes, g->node_count, edges, g->edge_count);
+        } else {
+            fprintf(out, "ERROR\n");
+        }
+        pthread_mutex_unlock(&g->write_lock);
+    } else if (strcmp(line, "!STATS") == 0) {
+        stats_print(out);
+    } else if (strcmp(line, "!SHUTDOWN") == 0) {
+        STORE(stop, 1);
+        fprintf(out, "OK\n");
+    } else {
+        // Formatted under the lock, sent after it: a slow client holds up nobody
+        FILE *text = sink_begin(&scratch);
+        if (!text) return fprintf(out, "ERROR\n") >= 0 && fflush(out) == 0;
+        pthread_mutex_lock(&g->write_lock);
+        // Written to the log, which survives the process; the next
+        // checkpoint (interval, !SAVE, shutdown) makes it durable
+        if (route(g, line, text) == 0) fputc('\n', text);
+        log_commit(g, 0);
+        pthread_mutex_unlock(&g->write_lock);
+        send_output(&scratch, out);
+    }
+    return fflush(out) == 0;
+}
+
+/* Client thread: serve lines until the client leaves or the server stops */
+void *serve_client(void *arg) {
+    Client *c = arg;
+    FILE *in = fdopen(dup(c->fd), "r");
+    FILE *out = fdopen(dup(c->fd), "w");
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t got;
+    
+    while (in && out && !LOAD(stop) && (got = getline(&line, &line_cap, in)) >= 0) {
+        size_t len = got;
+        if (len && line[len-1] == '\n') line[--len] = '\0';
+        if (len && line[len-1] == '\r') line[--len] = '\0';
+        if (!serve_line(c->graph, line, out)) break;
+    }
+    
+    free(line);
+    if (in) fclose(in);
+    if (out) fclose(out);
+    scratch_free(&scratch);
+    STORE(c->done, 1);
+    return NULL;
+}
+
+/* Serve the resident graph on a Unix socket until !SHUTDOWN or a signal */
+int serve(Graph *g, const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) return 0;
+    strcpy(addr.sun_path, path);
+    
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (lfd < 0) return 0;
+    unlink(path);
+    if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, 16) != 0) {
+        close(lfd);
+        return 0;
+    }
+    
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    
+    // Slots stay put while their thread runs; fd < 0 marks a free one
+    static Client clients[MAX_CLIENTS];
+    for (int i = 0; i < MAX_CLIENTS; i++) clients[i].fd = -1;
+    time_t last = time(NULL);
+    
+    while (!LOAD(stop)) {
+        // Wake up every second so !SHUTDOWN from a client thread is noticed
+        struct pollfd pfd = { .fd = lfd, .events = POLLIN };
+        int r = poll(&pfd, 1, 1000);
+        if (r < 0 && errno != EINTR) break;
+        
+        if (time(NULL) - last >= CHECKPOINT_SECS) {
+            pthread_mutex_lock(&g->write_lock);
+            if (unsaved(g)) checkpoint(g);     // Anything logged since the last one
+            pthread_mutex_unlock(&g->write_lock);
+            last = time(NULL);
+        }
+        
+        int free_slot = -1;
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            if (clients[i].fd >= 0 && LOAD(clients[i].done)) {
+                pthread_join(clients[i].thread, NULL);
+                close(clients[i].fd);
+                clients[i].fd = -1;
+            }
+            if (clients[i].fd < 0 && free_slot < 0) free_slot = i;
+        }
+        
+        if (r <= 0 || !(pfd.revents & POLLIN)) continue;
+        int cfd = accept(lfd, NULL, NULL);
+        if (cfd < 0) continue;
+        if (free_slot >= 0) {
+            Client *c = &clients[free_slot];
+            c->graph = g; c->fd = cfd; c->done = 0;
+            if (pthread_create(&c->thread, NULL, serve_client, c) == 0) continue;
+            c->fd = -1;
+        }
+        close(cfd);
+    }
+    
+    // Unblock threads sitting in getline() and wait for them to finish
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) shutdown(clients[i].fd, SHUT_RDWR);
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].fd < 0) continue;
+        pthread_join(clients[i].thread, NULL);
+        close(clients[i].fd);
+    }
+    close(lfd);
+    unlink(path);
+    checkpoint(g);
+    return 1;
+}
+
+/* Batch: route (or query) every line, checkpointing every N lines if asked */
+void batch(Graph *g, FILE *in, FILE *out, int readonly, unsigned long every) {
+    Stream st = {0};
+    unsigned long lines = 0;
+    for (;;) {
+        line_begin(g, &st, !readonly);
+        if (!stream_line(&st, in)) break;
+        if (readonly) query_end(g, &st, out);
+        else route_end(g, &st, out);
+        lines++;
+        if (every && lines % every == 0) checkpoint(g);
+        else if (lines % LOG_SYNC_LINES == 0) log_commit(g, 1);
+    }
+    stream_free(&st);
+}
+
+/* Whether another process holds the writer's lock on path; a server keeps
+ * it for as long as it runs */
+int writer_holds(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    int held = flock(fd, LOCK_SH | LOCK_NB) != 0 && errno == EWOULDBLOCK;
+    close(fd);
+    return held;
+}
+
+void usage() {
+    fprintf(stderr, "usage: melvin                  route one line from stdin\n"
+                    "       melvin --batch [file]   route every line of file (or stdin)\n"
+                    "              [--quiet] [--checkpoint-every N]\n"
+                    "       melvin --stats [...]    print hot-path counters to stderr at exit\n"
+                    "       melvin --query [...]    look up only: no new nodes/edges, no writes\n"
+                    "                               (doesn't wait for a writer such as --serve)\n"
+                    "       melvin --recover [...]  replay %s even if this boot wrote it\n"
+                    "       melvin --serve [sock]   keep the graph resident on a Unix socket\n"
+                    "                               (default %s)\n"
+                    "       melvin --shards N [...] the graph split over N files by token hash\n"
+                    "                               (not with --serve, --compact, --load, --top\n"
+                    "                               or --cache)\n"
+                    "       melvin --compact        decay weights, drop weak edges and orphan\n"
+                    "              [--decay PCT]    nodes, renumber and rewrite the graph\n"
+                    "              [--prune W]      (drops edges left below W, default 1)\n"
+                    "              [--reorder]      number nodes breadth-first for locality\n"
+                    "       melvin --load FILE      learn every line of FILE in parallel and\n"
+                    "              [--threads N]    rewrite the graph (default: one per core)\n"
+                    "with any of the above:\n"
+                    "       --depth N               follow at most N hops from the last token\n"
+                    "       --max-nodes N           stop after reaching N nodes\n"
+                    "       --min-weight W          skip edges lighter than W (0-255)\n"
+                    "       --top K                 best-first: the K strongest-path nodes\n"
+                    "       --spread                start from every token in the line, not the last\n"
+                    "       --delim CHARS           split tokens on these bytes (default: space)\n"
+                    "       --cache N               remember the last N query results (default %d,\n"
+                    "                               0 turns it off)\n", LOG_FILE, SOCKET_FILE, CACHE_ENTRIES);
+}
+
+// The library (libmelvin) and tools built on it (melvin_bench) bring their own main
+#ifndef MELVIN_NO_MAIN
+int main(int argc, char **argv) {
+    const char *sock = NULL, *file = NULL;
+    int batched = 0, quiet = 0, readonly = 0, recover = 0, show_stats = 0, compacting = 0, reorder = 0;
+    const char *corpus = NULL;
+    unsigned long decay = 0, prune = 1, shard_count = 0, threads = 0;
+    unsigned long cache = ULONG_MAX;    // Not given: the library default
+    unsigned long every = 0;
+    Walk walk = {0};
+    const char *delims = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--serve") == 0) {
+            sock = (i + 1 < argc && argv[i+1][0] != '-') ? argv[++i] : SOCKET_FILE;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batched = 1;
+        } else if (strcmp(argv[i], "--query") == 0) {
+            readonly = 1;
+        } else if (strcmp(argv[i], "--recover") == 0) {
+            recover = 1;
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            quiet = 1;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = 1;
+        } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            shard_count = strtoul(argv[++i], NULL, 10);
+            if (shard_count == 0) shard_count = ULONG_MAX;     // Refused below
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            compacting = 1;
+        } else if (strcmp(argv[i], "--reorder") == 0) {
+            compacting = reorder = 1;
+        } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+            corpus = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--decay") == 0 && i + 1 < argc) {
+            decay = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--prune") == 0 && i + 1 < argc) {
+            prune = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            batched = 1;
+            every = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            walk.max_depth = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--max-nodes") == 0 && i + 1 < argc) {
+            walk.max_visited = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--min-weight") == 0 && i + 1 < argc) {
+            unsigned long w = strtoul(argv[++i], NULL, 10);
+            walk.min_weight = w > 255 ? 255 : w;
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache = strtoul(argv[++i], NULL, 10);
+            if (cache > UINT32_MAX) cache = UINT32_MAX;
+        } else if (strcmp(argv[i], "--delim") == 0 && i + 1 < argc) {
+            delims = argv[++i];
+        } else if (strcmp(argv[i], "--spread") == 0) {
+            walk.spread = 1;
+        } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            walk.top_k = strtoul(argv[++i], NULL, 10);
+        } else if (argv[i][0] != '-' && !file) {
+            batched = 1;
+            file = argv[i];
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    
+    FILE *in = stdin;
+    if (file && !(in = fopen(file, "r"))) {
+        fprintf(stderr, "melvin: cannot read %s\n", file);
+        return 1;
+    }
+    
+    if ((readonly && (sock || recover || compacting || corpus)) || (compacting && (sock || batched)) ||
+        (corpus && (sock || batched || compacting)) || (shard_count && (sock || compacting || corpus || walk.top_k || cache != ULONG_MAX))) {
+        usage();
+        return 2;
+    }
+    int flags = readonly ? MELVIN_READONLY : recover ? MELVIN_RECOVER : 0;
+    // Queries don't wait out a writer (a server may run for days): they
+    // read the graph as it stands, without the lock, as show_graph does
+    if (readonly && !shard_count && writer_holds(GRAPH_FILE)) flags |= MELVIN_PEEK;
+    if (shard_count) {
+        MelvinShards *sh = melvin_shards_open(GRAPH_FILE, shard_count > SHARD_MAX ? 0 : shard_count, flags);
+        if (!sh) {
+            fprintf(stderr, "melvin: cannot map the shards of %s\n", GRAPH_FILE);
+            return 1;
+        }
+        melvin_shards_set_walk(sh, &walk);
+        if (delims) melvin_shards_set_delim(sh, delims);
+        shards_batch(sh, in, quiet ? NULL : stdout, readonly, every, batched);
+        if (batched && !readonly) shards_sync(sh, 1);
+        if (show_stats) stats_print(stderr);
+        melvin_shards_close(sh);
+        if (in != stdin) fclose(in);
+        return 0;
+    }
+    Melvin *m = melvin_open(GRAPH_FILE, flags);
+    if (!m) {
+        fprintf(stderr, "melvin: cannot map %s\n", GRAPH_FILE);
+        return 1;
+    }
+    melvin_set_walk(m, &walk);
+    if (delims) melvin_set_delim(m, delims);
+    if (cache != ULONG_MAX) melvin_set_cache(m, cache);
+    
+    int ok = 1;
+    if (compacting) {
+        uint32_t nodes = melvin_node_count(m), edges = melvin_edge_count(m);
+        ok = melvin_compact(m, decay, prune > 255 ? 255 : prune, reorder) == 0;
+        if (ok) {
+            printf("nodes %u -> %u, edges %u -> %u\n", nodes, melvin_node_count(m), edges, melvin_edge_count(m));
+        } else {
+            fprintf(stderr, "melvin: cannot compact %s\n", GRAPH_FILE);
+        }
+    } else if (corpus) {
+        uint32_t nodes = melvin_node_count(m), edges = melvin_edge_count(m);
+        ok = melvin_load(m, corpus, threads > LOAD_MAX_THREADS ? LOAD_MAX_THREADS : threads) == 0;
+        if (ok) {
+            printf("nodes %u -> %u, edges %u -> %u\n", nodes, melvin_node_count(m), edges, melvin_edge_count(m));
+        } else {
+            fprintf(stderr, "melvin: cannot load %s into %s\n", corpus, GRAPH_FILE);
+        }
+    } else if (sock) {
+        ok = serve(m, sock);
+        if (!ok) fprintf(stderr, "melvin: cannot listen on %s\n", sock);
+    } else if (batched) {
+        batch(m, in, quiet ? NULL : stdout, readonly, readonly ? 0 : every);
+    } else {
+        Stream st = {0};
+        line_begin(m, &st, !readonly);
+        if (stream_line(&st, in)) {
+            if (readonly) query_end(m, &st, stdout);
+            else route_end(m, &st, stdout);
+        }
+        stream_free(&st);
+    }
+    
+    // A finished batch leaves a sealed file; single lines just publish counts
+    if (batched && !readonly && !sock) checkpoint(m);
+    if (show_stats) stats_print(stderr);
+    melvin_close(m);
+    scratch_free(&scratch);
+    if (in != stdin) fclose(in);
+    return ok ? 0 : 1;
+}
+#endif
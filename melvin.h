@@ -0,0 +1,114 @@
+/*
+ * libmelvin: the graph engine as a library.
+ *
+ *   Melvin *m = melvin_open("melvin.mmap", 0);
+ *   char out[4096];
+ *   melvin_route(m, "cat sat mat", out, sizeof(out));   // "mat → ...\n"
+ *   melvin_close(m);
+ *
+ * Each handle is one graph file (plus its log, path with .mmap replaced by
+ * .log). A process may hold several. Routes on one handle are serialized;
+ * queries run in parallel with them and with each other from any thread,
+ * up to MELVIN_MAX_READERS at once.
+ */
+#ifndef MELVIN_H
+#define MELVIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MELVIN_API __attribute__((visibility("default")))
+
+typedef struct Melvin Melvin;
+
+/* melvin_open flags */
+#define MELVIN_READONLY 1   // Shared lock and PROT_READ mapping; query only
+#define MELVIN_RECOVER 2    // Replay the log even if this boot wrote it
+#define MELVIN_PEEK 4       // With READONLY: don't wait for a writer's lock
+
+/* Queries in flight at once on one handle; more wait for a free slot */
+#define MELVIN_MAX_READERS 128
+
+/* Walk bounds; zero means unbounded, which is the plain full walk */
+typedef struct {
+    uint32_t max_depth;     // Hops from the start node
+    uint32_t max_visited;   // Nodes reached, the start included
+    uint32_t top_k;         // Best-first: the K nodes with the strongest paths
+    uint8_t min_weight;     // Lighter edges are not followed
+    uint8_t spread;         // Start from every token of the line, levels in parallel
+} MelvinWalk;
+
+/* melvin_verify results */
+enum { MELVIN_OK, MELVIN_CORRUPT, MELVIN_UNSEALED, MELVIN_BUSY };
+
+/* Open (creating or upgrading if needed) a graph; NULL on failure, with the
+ * reason on stderr */
+MELVIN_API Melvin *melvin_open(const char *path, int flags);
+
+/* Make changes durable and release the graph */
+MELVIN_API void melvin_close(Melvin *m);
+
+/* Learn a line and walk from it; the walk's text ("last → reached ...\n",
+ * or nothing for an empty line) goes to out, NUL-terminated and cut to fit
+ * cap. Returns its full length, like snprintf, or -1 on a read-only handle. */
+MELVIN_API int melvin_route(Melvin *m, const char *line, char *out, size_t cap);
+
+/* Like melvin_route but read-only: unknown tokens are skipped */
+MELVIN_API int melvin_query(Melvin *m, const char *line, char *out, size_t cap);
+
+/* Bounds for later routes and queries; NULL for unbounded. Waits for
+ * routes and queries in flight. */
+MELVIN_API void melvin_set_walk(Melvin *m, const MelvinWalk *w);
+
+/* Queries remember the last entries results (default 1024; 0 turns the
+ * cache off). A result is reused only while the graph is unchanged. */
+MELVIN_API void melvin_set_cache(Melvin *m, uint32_t entries);
+
+/* Bytes separating tokens (newline always does); default " " */
+MELVIN_API void melvin_set_delim(Melvin *m, const char *delim);
+
+/* fsync the log (cheap) / fold it into a sealed, checksummed file */
+MELVIN_API int melvin_save(Melvin *m);
+MELVIN_API int melvin_checkpoint(Melvin *m);
+
+/* Decay every weight by decay percent, drop edges left below min_weight and
+ * nodes left without edges, renumber the rest densely (breadth-first with
+ * reorder, else first-seen order) and rewrite the file (sealed). Node ids
+ * change; 0, or -1 on failure or a read-only handle. */
+MELVIN_API int melvin_compact(Melvin *m, unsigned decay, uint8_t min_weight, int reorder);
+
+/* Learn every line of the corpus file, as melvin_route would, on threads
+ * threads (0: one per core), then append the result in place and seal it
+ * with a checkpoint. 0, or -1 on failure or a read-only handle. */
+MELVIN_API int melvin_load(Melvin *m, const char *corpus, uint32_t threads);
+
+/* A graph split over count files by token hash: path foo.mmap becomes
+ * foo.0.mmap .. foo.<count-1>.mmap, created together on first open and
+ * always opened with the same count. Edges crossing shards are followed
+ * and rules dispatched; walks give what one graph would. Top-K walks are
+ * not supported (top_k is ignored) and queries are not cached. Same
+ * threading rules as a single handle. */
+typedef struct MelvinShards MelvinShards;
+
+MELVIN_API MelvinShards *melvin_shards_open(const char *path, uint32_t count, int flags);
+MELVIN_API void melvin_shards_close(MelvinShards *s);
+MELVIN_API int melvin_shards_route(MelvinShards *s, const char *line, char *out, size_t cap);
+MELVIN_API int melvin_shards_query(MelvinShards *s, const char *line, char *out, size_t cap);
+MELVIN_API void melvin_shards_set_walk(MelvinShards *s, const MelvinWalk *w);
+MELVIN_API void melvin_shards_set_delim(MelvinShards *s, const char *delim);
+MELVIN_API int melvin_shards_checkpoint(MelvinShards *s);
+
+/* Read access for tools; ids and edge indexes count from 0 */
+MELVIN_API uint32_t melvin_node_count(Melvin *m);
+MELVIN_API uint32_t melvin_edge_count(Melvin *m);
+MELVIN_API const char *melvin_token(Melvin *m, uint32_t id, uint32_t *len);
+MELVIN_API int32_t melvin_value(Melvin *m, uint32_t id);
+/* First node whose token is the decimal number value ("-7", "42"),
+ * UINT32_MAX if none; never scans the nodes */
+MELVIN_API uint32_t melvin_find_value(Melvin *m, int32_t value);
+MELVIN_API int melvin_edge(Melvin *m, uint32_t e, uint32_t *from, uint32_t *to, uint8_t *weight);
+
+/* Check section checksums; bad gets a bit per failing section */
+MELVIN_API int melvin_verify(Melvin *m, uint64_t *bad);
+
+#endif
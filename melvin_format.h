@@ -0,0 +1,177 @@
+/*
+ * melvin.mmap on-disk format, shared by melvin and show_graph.
+ *
+ * [Header + section table] [section] [section] ...
+ *
+ * Sections are 64-byte aligned and found only through the table, so new
+ * sections can be appended without breaking readers that don't know them.
+ */
+#ifndef MELVIN_FORMAT_H
+#define MELVIN_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MELVIN_MAGIC 0x564C454Du        // "MELV"
+#define MELVIN_VERSION 5
+#define SECTION_ALIGN 64
+#define MAX_SECTIONS 32
+#define F_SEALED 1u                     // Section CRCs match the data (last checkpoint)
+#define MELVIN_RULE_SLOTS 64            // Rules exist for lines of up to 63 tokens
+
+/* Node and edge records of the copy-in files, which kept only the first
+ * 16 bytes of a longer token */
+typedef struct __attribute__((packed)) {
+    uint8_t token[16];
+    uint16_t token_len;
+    int32_t value;
+} PackedNode;
+
+typedef struct __attribute__((packed)) {
+    uint32_t from, to;
+    uint8_t weight;
+} PackedEdge;
+
+/* Sections this version writes, in file order. Nodes and edges are split
+ * into parallel, aligned arrays; node n's token is
+ * arena[token_off[n] .. + token_len[n]], edge e runs edge_from[e] -> edge_to[e].
+ * The CSR is double-buffered so a rebuild never touches the set readers use.
+ * rules[n] is the "rule_<n>token" node + 1 (0: none); values indexes
+ * numeric nodes by value like hash does tokens. */
+enum {
+    S_TOKEN_OFF, S_TOKEN_LEN, S_VALUE, S_ARENA,
+    S_EDGE_FROM, S_EDGE_TO, S_EDGE_W,
+    S_HASH, S_EHASH,
+    S_CSR_OFF, S_CSR_TO, S_CSR_POS, S_CSR_W,        // CSR set 0
+    S_CSR1_OFF, S_CSR1_TO, S_CSR1_POS, S_CSR1_W,    // CSR set 1
+    S_RULES, S_VALUES,
+    S_COUNT
+};
+#define CSR_SECTIONS 4
+
+typedef struct {
+    uint64_t offset, size;  // Where the section lives, how much room it has
+    uint64_t used;          // Bytes holding data; what the CRC covers
+    uint32_t crc;           // CRC-32 of the used bytes, valid when F_SEALED
+    uint32_t reserved;
+} Section;
+
+typedef struct {
+    uint32_t magic, version;
+    uint32_t header_crc;            // CRC-32 of the header with this field zero
+    uint32_t flags;
+    uint32_t section_count;
+    uint32_t node_count, node_cap;
+    uint32_t edge_count, edge_cap;
+    uint32_t hash_cap, ehash_cap;
+    uint32_t csr_nodes, csr_edges;  // Extent of the live CSR set
+    uint32_t csr_set;               // Which of the two CSR sets is live
+    uint32_t graph_id;              // Random, ties melvin.log to this graph
+    uint32_t log_seq;               // Checkpoint number; melvin.log carries the same
+    uint32_t arena_used, arena_cap; // Token bytes stored / room for them
+    uint32_t shard, shard_count;    // Which file of a sharded graph; 0 of 0: not sharded
+    uint32_t reserved[12];
+    Section sections[MAX_SECTIONS];
+} Header;
+
+/*
+ * melvin.log: mutations since the last checkpoint, appended as fixed-size
+ * records. Replaying them onto the checkpointed melvin.mmap rebuilds the
+ * state the page cache held before a crash.
+ */
+#define LOG_MAGIC 0x474F4C4Du           // "MLOG"
+#define LOG_VERSION 2
+
+/* L_NODE carries the first 16 token bytes; longer tokens continue in
+ * L_TOKEN records (id = node, from = byte position, token = next bytes) */
+enum { L_NODE = 1, L_EDGE, L_WEIGHT, L_TOKEN };
+
+typedef struct {
+    uint32_t magic, version;
+    uint32_t graph_id, log_seq;     // Must match the graph header to replay
+    uint32_t node_count, edge_count;    // At the checkpoint this log starts from
+    uint32_t arena_used, reserved;
+    char boot_id[40];               // Boot that wrote it; same boot = page cache intact
+} LogHeader;
+
+typedef struct {
+    uint8_t type;
+    uint8_t weight;                 // L_EDGE, L_WEIGHT: weight after the change
+    uint16_t token_len;             // L_NODE
+    uint32_t id;                    // Node id (L_NODE) or edge index
+    uint32_t from, to;              // L_EDGE; L_NODE: from = arena offset
+    int32_t value;                  // L_NODE
+    uint8_t token[16];              // L_NODE, L_TOKEN
+    uint32_t crc;                   // CRC-32 of the bytes before it
+} LogRecord;
+
+/* CRC-32 (IEEE), continued from crc; start with 0 */
+static inline uint32_t melvin_crc32(uint32_t crc, const void *data, size_t n) {
+    static uint32_t table[256];
+    if (!table[1]) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c >> 1) ^ (0xEDB88320u & -(c & 1));
+            table[i] = c;
+        }
+    }
+    const uint8_t *p = data;
+    crc = ~crc;
+    while (n--) crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+/* Header CRC: computed with header_crc itself taken as zero */
+static inline uint32_t melvin_header_crc(const Header *h) {
+    Header copy = *h;
+    copy.header_crc = 0;
+    return melvin_crc32(0, &copy, sizeof(copy));
+}
+
+/* Room a section needs for the header's capacities */
+static inline uint64_t melvin_section_size(const Header *h, int s) {
+    switch (s) {
+    case S_TOKEN_OFF: return (uint64_t)h->node_cap * sizeof(uint32_t);
+    case S_TOKEN_LEN: return (uint64_t)h->node_cap * sizeof(uint16_t);
+    case S_VALUE: return (uint64_t)h->node_cap * sizeof(int32_t);
+    case S_ARENA: return h->arena_cap;
+    case S_EDGE_FROM: case S_EDGE_TO: return (uint64_t)h->edge_cap * sizeof(uint32_t);
+    case S_EDGE_W: return h->edge_cap;
+    case S_HASH: case S_VALUES: return (uint64_t)h->hash_cap * sizeof(uint32_t);
+    case S_EHASH: return (uint64_t)h->ehash_cap * sizeof(uint32_t);
+    case S_CSR_OFF: case S_CSR1_OFF: return ((uint64_t)h->node_cap + 1) * sizeof(uint32_t);
+    case S_CSR_TO: case S_CSR1_TO:
+    case S_CSR_POS: case S_CSR1_POS: return (uint64_t)h->edge_cap * sizeof(uint32_t);
+    case S_CSR_W: case S_CSR1_W: return h->edge_cap;
+    case S_RULES: return MELVIN_RULE_SLOTS * sizeof(uint32_t);
+    }
+    return 0;
+}
+
+/* Cheap structural check of a mapped header: version, CRC, counts and a
+ * section table that fits the file; NULL if fine, else what is wrong */
+static inline const char *melvin_check(const Header *h, uint64_t file_size) {
+    if (file_size < sizeof(Header) || h->magic != MELVIN_MAGIC) return "not a graph";
+    if (h->version != MELVIN_VERSION) return "unsupported version";
+    if (h->header_crc != melvin_header_crc(h)) return "header checksum mismatch";
+    if (h->section_count < S_COUNT || h->section_count > MAX_SECTIONS) return "bad section table";
+    if (h->node_count > h->node_cap || h->edge_count > h->edge_cap ||
+        h->arena_used > h->arena_cap) return "bad counts";
+    if (h->hash_cap < 2 * (uint64_t)h->node_count || (h->hash_cap & (h->hash_cap - 1)) ||
+        h->ehash_cap < 2 * (uint64_t)h->edge_count || (h->ehash_cap & (h->ehash_cap - 1))) {
+        return "bad index size";
+    }
+
+    // Sections ascend without overlap, from the end of the header to the end of the file
+    uint64_t end = sizeof(Header);
+    for (uint32_t s = 0; s < h->section_count; s++) {
+        const Section *sec = &h->sections[s];
+        if (sec->offset % SECTION_ALIGN || sec->offset < end || sec->size > file_size ||
+            sec->offset > file_size - sec->size || sec->used > sec->size ||
+            (s < S_COUNT && sec->size < melvin_section_size(h, s))) return "bad section table";
+        end = sec->offset + sec->size;
+    }
+    return NULL;
+}
+
+#endif
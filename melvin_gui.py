@@ -7,11 +7,14 @@ A proper terminal interface for interacting with Melvin
 import tkinter as tk
 from tkinter import ttk, scrolledtext, filedialog, messagebox
 import subprocess
+import ctypes
 import os
 import threading
 from pathlib import Path
 
 class MelvinGUI:
+    MELVIN_READONLY = 1     # melvin.h
+    
     def __init__(self, root):
         self.root = root
         self.root.title("Melvin Terminal")
@@ -23,8 +26,28 @@ class MelvinGUI:
         
         self.melvin_path = "./melvin"
         self.debug_mode = tk.BooleanVar(value=False)
+        self.lib = self.open_library()
         self.setup_ui()
         
+    def open_library(self):
+        """libmelvin.so (make lib), or None to run ./melvin per line"""
+        try:
+            lib = ctypes.CDLL("./libmelvin.so")
+        except OSError:
+            return None
+        lib.melvin_open.restype = ctypes.c_void_p
+        lib.melvin_open.argtypes = [ctypes.c_char_p, ctypes.c_int]
+        lib.melvin_close.argtypes = [ctypes.c_void_p]
+        for name in ("melvin_route", "melvin_query"):
+            f = getattr(lib, name)
+            f.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t]
+        return lib
+    
+    def open_graph(self, query=False):
+        """Open the graph for one operation, like ./melvin does: a writer holds
+        its lock only until melvin_close, so other processes get their turn"""
+        return self.lib.melvin_open(b"melvin.mmap", self.MELVIN_READONLY if query else 0)
+    
     def setup_ui(self):
         # Main container
         main_frame = ttk.Frame(self.root, padding="10")
@@ -133,15 +156,30 @@ class MelvinGUI:
         self.output_text.see(tk.END)
         self.output_text.update()
     
-    def send_to_melvin(self, byte_data, show_debug=False):
-        """Send bytes to Melvin"""
+    def send_to_melvin(self, byte_data, show_debug=False, query=False, graph=None):
+        """Route bytes through Melvin, or look them up read-only (query);
+        graph: a handle already open for routing, else one is opened for this call"""
+        if self.lib:
+            handle = graph or self.open_graph(query)
+            if not handle:
+                return None, "Error: cannot open melvin.mmap"
+            try:
+                call = self.lib.melvin_query if query else self.lib.melvin_route
+                out = ctypes.create_string_buffer(65536)
+                if call(handle, byte_data, out, len(out)) < 0:
+                    return None, "Error: graph is read-only"
+                return out.value.decode('utf-8', errors='replace'), ""
+            finally:
+                if not graph:
+                    self.lib.melvin_close(handle)
+        
         env = os.environ.copy()
         if show_debug or self.debug_mode.get():
             env['MELVIN_DEBUG'] = '1'
         
         try:
             result = subprocess.run(
-                [self.melvin_path],
+                [self.melvin_path] + (["--query"] if query else []),
                 input=byte_data,
                 capture_output=True,
                 env=env,
@@ -194,7 +232,7 @@ class MelvinGUI:
     def _send_query_thread(self, text):
         """Background thread for query"""
         byte_data = text.encode('utf-8')
-        stdout, stderr = self.send_to_melvin(byte_data, show_debug=True)
+        stdout, stderr = self.send_to_melvin(byte_data, show_debug=True, query=True)
         self.root.after(0, self._handle_response, stdout, stderr, True)
     
     def _handle_response(self, stdout, stderr, is_query):
@@ -243,14 +281,22 @@ class MelvinGUI:
             total = len(lines)
             self.root.after(0, self.write_output, f"Training on {total} patterns...\n\n", "info")
             
-            for i, line in enumerate(lines, 1):
-                byte_data = line.encode('utf-8')
-                self.send_to_melvin(byte_data, show_debug=False)
-                
-                if i % 5 == 0 or i == total:
-                    msg = f"  [{i}/{total}] {line[:60]}{'...' if len(line) > 60 else ''}\n"
-                    self.root.after(0, self.write_output, msg, "debug")
-                    self.root.after(0, self.status_var.set, f"Training... {i}/{total}")
+            # One handle for the whole run: the lock is taken once, released at the end
+            graph = self.open_graph() if self.lib else None
+            if self.lib and not graph:
+                raise OSError("cannot open melvin.mmap")
+            try:
+                for i, line in enumerate(lines, 1):
+                    byte_data = line.encode('utf-8')
+                    self.send_to_melvin(byte_data, show_debug=False, graph=graph)
+                    
+                    if i % 5 == 0 or i == total:
+                        msg = f"  [{i}/{total}] {line[:60]}{'...' if len(line) > 60 else ''}\n"
+                        self.root.after(0, self.write_output, msg, "debug")
+                        self.root.after(0, self.status_var.set, f"Training... {i}/{total}")
+            finally:
+                if graph:
+                    self.lib.melvin_close(graph)
             
             self.root.after(0, self.write_output, "\n✓ Training complete!\n", "success")
             self.root.after(0, self.status_var.set, "Training complete")
@@ -1,67 +1,289 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 
-typedef struct __attribute__((packed)) {
-    uint8_t token[16];
-    uint16_t token_len;
-    int32_t value;
-} Node;
-
-typedef struct __attribute__((packed)) {
-    uint32_t from;
-    uint32_t to;
-    uint8_t weight;
-} Edge;
-
-int main() {
-    int fd = open("melvin.mmap", O_RDONLY);
-    if (fd < 0) {
+#include "melvin_format.h"
+#include "melvin.h"
+
+#define SHOW_ROWS 20        // Rows of each table without --all
+#define LOG_BUCKETS 33      // Degree and token length: 0, 1, 2-3, 4-7, ... 2^31-2^32-1
+
+enum { TEXT, CSV, BINARY };
+
+/* What to list: nodes by token prefix and out-degree, edges leaving a
+ * listed node by weight */
+typedef struct {
+    const char *prefix;
+    size_t prefix_len;
+    uint32_t min_degree;
+    unsigned min_weight, max_weight;
+} Filter;
+
+void show_usage() {
+    fprintf(stderr, "usage: show_graph [file]        summary, first %d nodes and edges (default melvin.mmap)\n"
+                    "       --all                    every node and edge, streamed\n"
+                    "       --nodes | --edges        only that table\n"
+                    "       --prefix P               nodes whose token starts with P, edges leaving them\n"
+                    "       --min-degree D           nodes with at least D out-edges\n"
+                    "       --min-weight W           edges of weight W or more\n"
+                    "       --max-weight W           edges of weight W or less\n"
+                    "       --csv                    node table: id,token,value,degree;\n"
+                    "                                edge table: from,to,weight,from_token,to_token\n"
+                    "       --binary                 records: 'N' u32 id, i32 value, u32 degree,\n"
+                    "                                u16 len, token; 'E' u32 from, u32 to, u8 weight\n"
+                    "                                (native byte order)\n"
+                    "       --hist                   out-degree, token length and weight histograms\n", SHOW_ROWS);
+}
+
+int selected(Melvin *m, const Filter *f, const uint32_t *degree, uint32_t id) {
+    if (degree[id] < f->min_degree) return 0;
+    if (!f->prefix_len) return 1;
+    uint32_t len;
+    const char *token = melvin_token(m, id, &len);
+    return token && len >= f->prefix_len && memcmp(token, f->prefix, f->prefix_len) == 0;
+}
+
+/* A token as a CSV field: always quoted, quotes doubled */
+void csv_token(const char *token, uint32_t len) {
+    putchar('"');
+    for (uint32_t i = 0; i < len; i++) {
+        if (token[i] == '"') putchar('"');
+        putchar(token[i]);
+    }
+    putchar('"');
+}
+
+void print_node(Melvin *m, int format, uint32_t id, uint32_t degree) {
+    uint32_t len;
+    const char *token = melvin_token(m, id, &len);
+    int32_t value = melvin_value(m, id);
+    if (!token) len = 0;
+    if (format == BINARY) {
+        uint16_t l = len;
+        putchar('N');
+        fwrite(&id, 4, 1, stdout); fwrite(&value, 4, 1, stdout); fwrite(&degree, 4, 1, stdout);
+        fwrite(&l, 2, 1, stdout); fwrite(token, 1, len, stdout);
+    } else if (format == CSV) {
+        printf("%u,", id);
+        csv_token(token, len);
+        printf(",%d,%u\n", value, degree);
+    } else {
+        if (token) printf("%2u: \"%.*s\"", id, (int)len, token);
+        else printf("%2u: (token out of range)", id);
+        if (value != 0) printf(" (val=%d)", value);
+        printf("\n");
+    }
+}
+
+void print_edge(Melvin *m, int format, uint32_t from, uint32_t to, uint8_t weight) {
+    uint32_t from_len, to_len;
+    const char *a = melvin_token(m, from, &from_len), *b = melvin_token(m, to, &to_len);
+    if (format == BINARY) {
+        putchar('E');
+        fwrite(&from, 4, 1, stdout); fwrite(&to, 4, 1, stdout); fwrite(&weight, 1, 1, stdout);
+    } else if (format == CSV) {
+        printf("%u,%u,%u,", from, to, weight);
+        csv_token(a, a ? from_len : 0);
+        putchar(',');
+        csv_token(b, b ? to_len : 0);
+        putchar('\n');
+    } else {
+        printf("%2u→%2u", from, to);
+        if (a && b) printf("  \"%.*s\" → \"%.*s\"", (int)from_len, a, (int)to_len, b);
+        printf("  w=%u\n", weight);
+    }
+}
+
+/* Bar of a histogram row, scaled to the fullest bucket */
+void print_bar(FILE *out, uint64_t count, uint64_t most) {
+    int width = most ? (int)(count * 40 / most) : 0;
+    if (count && !width) width = 1;
+    for (int i = 0; i < width; i++) fputc('#', out);
+    fputc('\n', out);
+}
+
+/* Bucket of a power-of-two histogram */
+uint32_t log_bucket(uint32_t x) {
+    return x ? 32 - __builtin_clz(x) : 0;
+}
+
+/* A power-of-two histogram, up to its last non-empty bucket */
+void print_log_hist(FILE *out, const char *title, const uint64_t hist[LOG_BUCKETS]) {
+    uint64_t most = 0;
+    uint32_t top = 0;
+    for (uint32_t b = 0; b < LOG_BUCKETS; b++) {
+        if (hist[b] > most) most = hist[b];
+        if (hist[b]) top = b;
+    }
+    fprintf(out, "%s:\n", title);
+    for (uint32_t b = 0; b <= top; b++) {
+        uint64_t lo = b ? 1ull << (b - 1) : 0, hi = b ? (1ull << b) - 1 : 0;
+        if (lo == hi) fprintf(out, "%10llu       %10llu ", (unsigned long long)lo, (unsigned long long)hist[b]);
+        else fprintf(out, "%10llu-%-6llu%10llu ", (unsigned long long)lo, (unsigned long long)hi,
+                     (unsigned long long)hist[b]);
+        print_bar(out, hist[b], most);
+    }
+}
+
+/* Format version the file records in its header */
+uint32_t file_version(const char *path) {
+    Header h = {0};
+    FILE *file = fopen(path, "rb");
+    if (file) {
+        if (fread(&h, sizeof(h), 1, file) != 1) h.version = 0;
+        fclose(file);
+    }
+    return h.version;
+}
+
+int main(int argc, char **argv) {
+    const char *path = "melvin.mmap";
+    int all = 0, nodes = 1, edges = 1, hist = 0, format = TEXT;
+    Filter f = { .max_weight = 255 };
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--all") == 0) {
+            all = 1;
+        } else if (strcmp(argv[i], "--nodes") == 0) {
+            edges = 0;
+        } else if (strcmp(argv[i], "--edges") == 0) {
+            nodes = 0;
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            format = CSV;
+        } else if (strcmp(argv[i], "--binary") == 0) {
+            format = BINARY;
+        } else if (strcmp(argv[i], "--hist") == 0) {
+            hist = 1;
+        } else if (strcmp(argv[i], "--prefix") == 0 && i + 1 < argc) {
+            f.prefix = argv[++i];
+            f.prefix_len = strlen(f.prefix);
+        } else if (strcmp(argv[i], "--min-degree") == 0 && i + 1 < argc) {
+            f.min_degree = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--min-weight") == 0 && i + 1 < argc) {
+            f.min_weight = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--max-weight") == 0 && i + 1 < argc) {
+            f.max_weight = strtoul(argv[++i], NULL, 10);
+        } else if (argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            show_usage();
+            return 2;
+        }
+    }
+    if (!nodes && !edges) nodes = edges = 1;    // --nodes --edges: both
+    if (format != TEXT) all = 1;                // Data for other tools: no summary, no cut
+
+    if (access(path, F_OK) != 0) {
         printf("No graph\n");
         return 1;
     }
-    
-    struct stat st;
-    fstat(fd, &st);
-    
-    void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (mem == MAP_FAILED) { close(fd); return 1; }
-    
-    uint32_t *header = (uint32_t *)mem;
-    uint32_t node_count = header[0];
-    uint32_t edge_count = header[2];
-    
-    size_t hsize = sizeof(uint32_t) * 4;
-    Node *nodes = (Node *)((char *)mem + hsize);
-    Edge *edges = (Edge *)((char *)mem + hsize + node_count * sizeof(Node));
-    
-    printf("GRAPH: %u nodes, %u edges\n\n", node_count, edge_count);
-    
-    printf("NODES:\n");
-    for (uint32_t i = 0; i < node_count && i < 20; i++) {
-        printf("%2u: \"%.*s\"", i, nodes[i].token_len, nodes[i].token);
-        if (nodes[i].value != 0) printf(" (val=%d)", nodes[i].value);
-        printf("\n");
+
+    // Peek: a writer may hold the graph, we only look
+    Melvin *m = melvin_open(path, MELVIN_READONLY | MELVIN_PEEK);
+    if (!m) {
+        printf("Not a graph\n");
+        return 1;
     }
-    if (node_count > 20) printf("... (%u more)\n", node_count - 20);
-    
-    printf("\nEDGES:\n");
-    for (uint32_t i = 0; i < edge_count && i < 20; i++) {
-        printf("%2u→%2u", edges[i].from, edges[i].to);
-        if (edges[i].from < node_count && edges[i].to < node_count) {
-            printf("  \"%.*s\" → \"%.*s\"",
-                   nodes[edges[i].from].token_len, nodes[edges[i].from].token,
-                   nodes[edges[i].to].token_len, nodes[edges[i].to].token);
+    uint32_t node_count = melvin_node_count(m);
+    uint32_t edge_count = melvin_edge_count(m);
+    static char buf[1 << 16];
+    setvbuf(stdout, buf, _IOFBF, sizeof(buf));
+
+    if (format == TEXT) {
+        printf("GRAPH: %u nodes, %u edges\n", node_count, edge_count);
+
+        uint64_t bad;
+        uint32_t version = file_version(path);
+        switch (melvin_verify(m, &bad)) {
+        case MELVIN_BUSY:
+            printf("FORMAT: v%u, in use by a writer (checksums not checked)\n\n", version);
+            break;
+        case MELVIN_UNSEALED:
+            printf("FORMAT: v%u, changed since last checkpoint (checksums not checked)\n\n", version);
+            break;
+        default:
+            for (uint32_t s = 0; s < 64; s++) {
+                if (bad >> s & 1) printf("CHECKSUM MISMATCH in section %u\n", s);
+            }
+            printf("FORMAT: v%u, %s\n\n", version, bad ? "CORRUPT" : "checksums OK");
         }
-        printf("\n");
     }
-    if (edge_count > 20) printf("... (%u more)\n", edge_count - 20);
-    
-    munmap(mem, st.st_size);
-    close(fd);
+
+    // Out-degrees first: the degree filter needs them before anything is
+    // listed. Without node filters every edge in the weight range counts,
+    // so its weight is binned here and the edges are read only once.
+    uint32_t *degree = calloc((size_t)node_count + 1, sizeof(uint32_t));
+    if (!degree) {
+        fprintf(stderr, "show_graph: out of memory for %u nodes\n", node_count);
+        melvin_close(m);
+        return 1;
+    }
+    uint64_t degree_hist[LOG_BUCKETS] = {0}, length_hist[LOG_BUCKETS] = {0}, weight_hist[16] = {0};
+    uint64_t shown_nodes = 0, shown_edges = 0;
+    int node_filter = f.prefix_len || f.min_degree;
+    for (uint32_t e = 0; e < edge_count; e++) {
+        uint32_t from, to;
+        uint8_t weight;
+        if (!melvin_edge(m, e, &from, &to, &weight) || from >= node_count) continue;
+        degree[from]++;
+        if (!node_filter && weight >= f.min_weight && weight <= f.max_weight) weight_hist[weight >> 4]++;
+    }
+
+    // Histograms cover the nodes the filters select and the edges leaving them
+    if (nodes || hist) {
+        if (nodes && format == TEXT) printf("NODES:\n");
+        if (nodes && format == CSV) printf("id,token,value,degree\n");
+        for (uint32_t i = 0; i < node_count; i++) {
+            if (!selected(m, &f, degree, i)) continue;
+            if (nodes && (all || shown_nodes < SHOW_ROWS)) print_node(m, format, i, degree[i]);
+            uint32_t len = 0;
+            melvin_token(m, i, &len);
+            degree_hist[log_bucket(degree[i])]++;
+            length_hist[log_bucket(len)]++;
+            shown_nodes++;
+        }
+        if (nodes && format == TEXT && shown_nodes > SHOW_ROWS && !all) {
+            printf("... (%llu more)\n", (unsigned long long)(shown_nodes - SHOW_ROWS));
+        }
+    }
+
+    if (edges || (hist && node_filter)) {
+        int listing = edges;
+        if (listing && format == TEXT) printf("%sEDGES:\n", nodes ? "\n" : "");
+        if (listing && format == CSV) printf("%sfrom,to,weight,from_token,to_token\n", nodes ? "\n" : "");
+        for (uint32_t e = 0; e < edge_count; e++) {
+            uint32_t from, to;
+            uint8_t weight;
+            if (!melvin_edge(m, e, &from, &to, &weight) || from >= node_count) continue;
+            if (weight < f.min_weight || weight > f.max_weight || !selected(m, &f, degree, from)) continue;
+            if (listing && (all || shown_edges < SHOW_ROWS)) print_edge(m, format, from, to, weight);
+            if (node_filter) weight_hist[weight >> 4]++;
+            shown_edges++;
+        }
+        if (listing && format == TEXT && shown_edges > SHOW_ROWS && !all) {
+            printf("... (%llu more)\n", (unsigned long long)(shown_edges - SHOW_ROWS));
+        }
+    }
+
+    if (hist) {
+        FILE *out = format == TEXT ? stdout : stderr;   // Keep data streams clean
+        if (out == stderr) fflush(stdout);
+        if (format == TEXT) fputc('\n', out);
+        print_log_hist(out, "OUT-DEGREE", degree_hist);
+        fputc('\n', out);
+        print_log_hist(out, "TOKEN LENGTH", length_hist);
+        uint64_t most = 0;
+        for (int b = 0; b < 16; b++) if (weight_hist[b] > most) most = weight_hist[b];
+        fprintf(out, "\nWEIGHT:\n");
+        for (int b = 0; b < 16; b++) {
+            fprintf(out, "%10d-%-6d%10llu ", b * 16, b * 16 + 15, (unsigned long long)weight_hist[b]);
+            print_bar(out, weight_hist[b], most);
+        }
+    }
+
+    fflush(stdout);
+    free(degree);
+    melvin_close(m);
     return 0;
 }
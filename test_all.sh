@@ -14,8 +14,9 @@ test() {
     local desc=$1
     local input=$2
     local expected=$3
+    local flags=$4
     
-    result=$(echo "$input" | ./melvin 2>/dev/null)
+    result=$(echo "$input" | ./melvin $flags 2>/dev/null)
     
     if echo "$result" | grep -q "$expected"; then
         echo -e "${GREEN}✓${NC} $desc"
@@ -31,7 +32,7 @@ echo "║           UNIFIED MELVIN - COMPREHENSIVE TEST              ║"
 echo "╚════════════════════════════════════════════════════════════╝"
 echo ""
 
-rm -f melvin.mmap
+rm -f melvin.mmap melvin.log
 
 echo "TEST SUITE 1: Organic Learning"
 echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
@@ -71,6 +72,18 @@ test "XOR(0,0)" "0 XOR 0" "0"
 test "XOR(0,1)" "0 XOR 1" "1"
 test "XOR(1,1)" "1 XOR 1" "0"
 
+# A rule node routes every line of its length to what it points to; the
+# registry survives reopening and compaction (on a graph of its own)
+mv melvin.mmap melvin_keep.mmap; mv melvin.log melvin_keep.log
+echo "qa qb" | ./melvin > /dev/null 2>&1
+echo "ruled next" | ./melvin > /dev/null 2>&1
+echo "rule_2token ruled" | ./melvin > /dev/null 2>&1
+test "Rule dispatches lines of its length" "qa qb" "^qb ruled → next" "--query"
+test "Rule leaves other lengths alone" "qb" "^qb → $" "--query"
+./melvin --compact > /dev/null 2>&1
+test "Rule registry survives compaction" "qa qb" "ruled → next" "--query"
+mv melvin_keep.mmap melvin.mmap; mv melvin_keep.log melvin.log
+
 echo ""
 
 echo "TEST SUITE 4: Mixed Mode"
@@ -81,6 +94,487 @@ echo "five plus three" | ./melvin > /dev/null 2>&1
 test "Symbolic learning" "five" "plus"
 test "Numeric computation" "5 + 3" "8"
 
+echo ""
+
+echo "TEST SUITE 5: Batch Mode"
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo ""
+
+printf "red green blue\nsun moon\n" | ./melvin --batch > /dev/null 2>&1
+test "Batch first line" "red" "green"
+test "Batch last line" "sun" "moon"
+
+echo ""
+
+echo "TEST SUITE 6: Query Mode"
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo ""
+
+# Pass if value ($2) matches the grep pattern ($3)
+check() {
+    if echo "$2" | grep -q "$3"; then
+        echo -e "${GREEN}✓${NC} $1"
+        ((passed++))
+    else
+        echo -e "${RED}✗${NC} $1 (got: $2)"
+        ((failed++))
+    fi
+}
+
+test "Read-only lookup" "cat" "sat" "--query"
+before=$(cksum < melvin.mmap)
+echo "ghost town" | ./melvin --query > /dev/null 2>&1
+check "Query leaves graph untouched" "$(cksum < melvin.mmap)" "^$before$"
+
+echo ""
+
+echo "TEST SUITE 7: Capacity Growth"
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo ""
+
+# Well past the starting capacity: nothing may be dropped on the way
+seq 1 3000 | sed 's/.*/grow&a grow&b/' | ./melvin --batch --quiet > /dev/null 2>&1
+test "Nodes past initial capacity" "grow2999a" "grow2999b"
+test "Earlier nodes survive growth" "grow1a" "grow1b"
+
+# Tokens longer than 16 bytes are stored whole, not cut to a shared prefix
+echo "hyperparameter_set_one after_one" | ./melvin > /dev/null 2>&1
+echo "hyperparameter_set_two after_two" | ./melvin > /dev/null 2>&1
+result=$(echo "hyperparameter_set_two" | ./melvin --query 2>/dev/null)
+check "Long tokens stay distinct" "$result" "^hyperparameter_set_two → after_two $"
+
+# One line past the old 100-token / 4096-byte limits is still one line
+seq 1 1000 | sed 's/^/line/' | tr '\n' ' ' | ./melvin > /dev/null 2>&1
+test "Long lines stay whole" "line999" "line1000" "--query"
+echo "csv1,csv2" | ./melvin --delim , > /dev/null 2>&1
+test "Custom delimiters" "csv1" "csv1 → csv2" "--query"
+
+echo ""
+
+echo "TEST SUITE 8: Crash Recovery"
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo ""
+
+# Lose every page written after the checkpoint, then replay melvin.log
+./melvin --batch /dev/null
+cp melvin.mmap melvin.mmap.snap
+echo "lost words found" | ./melvin > /dev/null 2>&1
+mv melvin.mmap.snap melvin.mmap
+./melvin --recover < /dev/null > /dev/null 2>&1
+test "Log replay restores changes" "lost" "words" "--query"
+
+# Killed mid-batch in this boot: the reopen trusts the header, which must
+# count everything the log holds, and new ids must not reuse logged ones.
+# The kill comes once the last line's walk is out, with input still open
+rm -f melvin.mmap melvin.log
+./melvin --batch /dev/null
+(seq 1 1000 | sed 's/.*/kx& ky&/'; sleep 5) 2>/dev/null |
+    stdbuf -oL ./melvin --batch > melvin_walks.txt 2>/dev/null &
+for i in $(seq 100); do grep -q "^ky1000 →" melvin_walks.txt && break; sleep 0.1; done
+kill -9 $!; wait $! 2>/dev/null
+rm -f melvin_walks.txt
+echo "kz1 kz2" | ./melvin > /dev/null 2>&1
+test "Reopen after a kill keeps logged changes" "kx900" "ky900" "--query"
+
+echo ""
+
+echo "TEST SUITE 9: Bounded Walks"
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo ""
+
+echo "walk1 walk2 walk3 walk4" | ./melvin > /dev/null 2>&1
+printf 'hub weak\nhub strong\nhub strong\nhub strong\n' | ./melvin --batch --quiet > /dev/null 2>&1
+result=$(echo "walk1" | ./melvin --query --depth 1 2>/dev/null)
+check "Depth bound stops the walk" "$result" "^walk1 → walk2 $"
+result=$(echo "hub" | ./melvin --query --top 1 2>/dev/null)
+check "Top-K walk takes the heaviest edge first" "$result" "^hub → strong $"
+result=$(echo "walk3 hub" | ./melvin --query --spread --depth 1 2>/dev/null)
+check "Spread walk starts from every token" "$result" "^walk3 hub → walk4 weak strong $"
+result=$(echo "walk3 hub walk1" | ./melvin --query --spread --top 1 --max-nodes 2 2>/dev/null)
+check "Top-K walk keeps a node bound below its sources" "$result" "^walk3 hub walk1 → $"
+
+# A 70-edge row spans several vector-width blocks, a scalar tail and edges
+# chained past the CSR; heavier ones (115, mw20 at 130) sit in each part
+(seq 1 70 | sed 's/^/mw mw/'; printf 'mw mw%s\n' 5 20 20 40 65 70) | ./melvin --batch --quiet > /dev/null 2>&1
+result=$(echo "mw" | ./melvin --query --depth 1 --min-weight 115 2>/dev/null)
+check "Min weight follows edges at the threshold" "$result" "^mw → mw5 mw20 mw40 mw65 mw70 $"
+result=$(echo "mw" | ./melvin --query --depth 1 --min-weight 116 2>/dev/null)
+check "Min weight skips edges below it" "$result" "^mw → mw20 $"
+
+# One ctypes binding of libmelvin for every Python test: py runs the script
+# on its stdin with lib, Walk and ask(m, line, route) already defined
+melvin_py='
+import ctypes, os, struct, subprocess, sys, threading, time
+lib = ctypes.CDLL("./libmelvin.so")
+lib.melvin_open.restype = ctypes.c_void_p
+lib.melvin_open.argtypes = [ctypes.c_char_p, ctypes.c_int]
+lib.melvin_close.argtypes = [ctypes.c_void_p]
+lib.melvin_checkpoint.argtypes = [ctypes.c_void_p]
+for f in (lib.melvin_route, lib.melvin_query):
+    f.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t]
+lib.melvin_set_walk.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+lib.melvin_set_cache.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+lib.melvin_load.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint32]
+lib.melvin_find_value.restype = ctypes.c_uint32
+lib.melvin_find_value.argtypes = [ctypes.c_void_p, ctypes.c_int32]
+lib.melvin_token.restype = ctypes.c_void_p
+lib.melvin_token.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.POINTER(ctypes.c_uint32)]
+class Walk(ctypes.Structure):
+    _fields_ = [("max_depth", ctypes.c_uint32), ("max_visited", ctypes.c_uint32),
+                ("top_k", ctypes.c_uint32), ("min_weight", ctypes.c_uint8), ("spread", ctypes.c_uint8)]
+def ask(m, line, route=False):
+    out = ctypes.create_string_buffer(4096)
+    (lib.melvin_route if route else lib.melvin_query)(m, line, out, 4096)
+    return out.value.decode()
+'
+py() {
+    python3 -c "$melvin_py$(cat)" "$@"
+}
+
+# Wide levels go to the graph's thread pool: concurrent spread walks agree,
+# and the pool's threads outlive a walk but not the handle
+(seq 1 6000 | sed 's/.*/fan fx&/'; seq 1 6000 | sed 's/.*/fx& fy&/') > melvin_fan.txt
+rm -f melvin_fan.mmap melvin_fan.log
+result=$(py <<'PY' 2>&1
+m = lib.melvin_open(b"melvin_fan.mmap", 0)
+lib.melvin_load(m, b"melvin_fan.txt", 0)
+lib.melvin_set_walk(m, ctypes.byref(Walk(spread=1)))
+tasks = lambda: (time.sleep(0.2), len(os.listdir("/proc/self/task")))[1]
+want = {w: ask(m, w) for w in (b"fan", b"fan fx1", b"fx2")}
+idle = tasks()
+wrong = []
+def reader(line):
+    for _ in range(50):
+        if ask(m, line) != want[line]: wrong.append(line)
+threads = [threading.Thread(target=reader, args=(w,)) for w in (b"fan", b"fan fx1", b"fx2", b"fan")]
+for t in threads: t.start()
+for t in threads: t.join()
+kept = tasks()
+lib.melvin_close(m)
+print("consistent" if not wrong and "fx1" in want[b"fan"] else "wrong: %d" % len(wrong))
+print("reused" if kept == idle and tasks() == 1 else "threads: %d, then %d" % (idle, kept))
+PY
+)
+rm -f melvin_fan.txt melvin_fan.mmap melvin_fan.log
+check "Concurrent spread walks agree" "$result" "^consistent"
+check "Spread walks share the graph's thread pool" "$result" "^reused"
+
+echo ""
+
+echo "TEST SUITE 10: Instrumentation"
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo ""
+
+result=$(echo "stat1 stat2 stat3" | ./melvin --stats 2>&1 >/dev/null)
+check "--stats counts new nodes" "$result" "nodes_created=3 "
+check "--stats counts new edges" "$result" "edges_created=2 "
+
+echo ""
+
+echo "TEST SUITE 11: Compaction"
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo ""
+
+# hub → weak was seen once, hub → strong three times
+./melvin --compact --prune 120 > /dev/null 2>&1
+result=$(echo "hub weak" | ./melvin --query 2>/dev/null)
+check "Compaction drops weak edges and their orphan nodes" "$result" "^hub → strong $"
+
+# Renumbering moves ids, not the walk
+before=$(echo "hub" | ./melvin --query 2>/dev/null)
+./melvin --compact --reorder > /dev/null 2>&1
+result=$(echo "hub" | ./melvin --query 2>/dev/null)
+check "Breadth-first reordering keeps walks the same" "$result" "^${before:-(no walk before)}$"
+
+echo ""
+
+echo "TEST SUITE 12: Shards"
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo ""
+
+# Walks cross shard boundaries and see the whole chain
+rm -f melvin.[0-9].mmap melvin.[0-9].log
+printf 'sh1 sh2 sh3 sh4\nsh4 sh5\n' | ./melvin --shards 4 --batch --quiet > /dev/null 2>&1
+result=$(echo "sh1" | ./melvin --shards 4 --query 2>/dev/null)
+check "Sharded walk follows edges across shards" "$result" "^sh1 → sh2 sh3 sh4 sh5 $"
+
+# Rules dispatch as on one graph; with 4 shards "ruled" lives apart from
+# rule_2token, which reaches it through a stub
+printf 'qa qb\nruled next\nrule_2token ruled\nrule_2token other\nother more\n' |
+    ./melvin --shards 4 --batch --quiet > /dev/null 2>&1
+result=$(echo "qa qb" | ./melvin --shards 4 --query 2>/dev/null)
+check "Sharded walk dispatches rules" "$result" "^qb ruled other → next more $"
+./melvin --shards 4 --query --cache 8 < /dev/null > /dev/null 2>&1
+check "Sharded graphs refuse --cache" "$?" "^2$"
+rm -f melvin.[0-9].mmap melvin.[0-9].log
+
+echo ""
+
+echo "TEST SUITE 13: Numeric Values"
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo ""
+
+# Signed numbers get their value; ones too big for 32 bits get none
+rm -f melvin.mmap melvin.log
+echo "-42 99999999999999999999999999999999999999" | ./melvin > /dev/null 2>&1
+result=$(./show_graph 2>/dev/null | grep -c -e '"-42" (val=-42)' -e ': "99999999999999999999999999999999999999"$')
+check "Signed and overflowing numeric tokens" "$result" "^2$"
+
+# The value index finds numbers in an upgraded copy-in file (which stored 0
+# for "-7") and in new lines, before and after reopening
+rm -f melvin_num.mmap melvin_num.log
+result=$(py <<'PY' 2>&1
+nodes = [b"-7", b"12", b"seven"]
+with open("melvin_num.mmap", "wb") as f:
+    f.write(struct.pack("<4I", len(nodes), 0, 2, 0))
+    for t in nodes:
+        f.write(struct.pack("<16sHi", t, len(t), 12 if t == b"12" else 0))
+    f.write(struct.pack("<IIB", 0, 2, 1) + struct.pack("<IIB", 1, 2, 1))
+def found(m):
+    out, n = [], ctypes.c_uint32()
+    for v in (-7, 12, -13, 0):
+        i = lib.melvin_find_value(m, v)
+        out.append(b"-" if i == 0xFFFFFFFF else ctypes.string_at(lib.melvin_token(m, i, ctypes.byref(n)), n.value))
+    return b" ".join(out).decode()
+m = lib.melvin_open(b"melvin_num.mmap", 0)
+ask(m, b"-13 x", True)
+before = found(m)
+lib.melvin_close(m)
+m = lib.melvin_open(b"melvin_num.mmap", 1)
+print(before, "|", found(m))
+lib.melvin_close(m)
+PY
+)
+check "Value index across upgrade and reopen" "$result" "^-7 12 -13 - | -7 12 -13 -$"
+rm -f melvin_num.mmap melvin_num.log
+
+echo ""
+
+echo "TEST SUITE 14: Bulk Load"
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo ""
+
+# A loaded corpus walks like one routed line by line
+printf 'bl1 bl2 bl3\nbl3 bl4\n' > melvin_corpus.txt
+./melvin --load melvin_corpus.txt --threads 2 > /dev/null 2>&1
+result=$(echo "bl1" | ./melvin --query 2>/dev/null)
+check "Bulk load learns every line" "$result" "^bl1 → bl2 bl3 bl4 $"
+rm -f melvin_corpus.txt
+
+# A process waiting for the lock during a load writes into the loaded file
+printf 'bw1 bw2\nbw2 bw3\n' > melvin_corpus.txt
+waited=$(py <<'PY' 2>&1
+m = lib.melvin_open(b"melvin.mmap", 0)
+waiter = subprocess.Popen("echo 'bx1 bx2' | ./melvin", shell=True,
+                          stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+print(waiter.stderr.readline(), end="")
+lib.melvin_load(m, b"melvin_corpus.txt", 2)
+lib.melvin_close(m)
+waiter.wait()
+PY
+)
+check "Writer waits for the lock during a load" "$waited" "waiting for melvin.mmap"
+result=$(printf 'bw1\nbx1\n' | ./melvin --query --batch 2>/dev/null | tr '\n' '|')
+check "Writer waiting on a load keeps both" "$result" "^bw1 → bw2 bw3 |bx1 → bx2 |$"
+rm -f melvin_corpus.txt
+
+echo ""
+
+echo "TEST SUITE 15: Inspection"
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo ""
+
+# Filtered CSV: only the edges leaving bl1, with their weights
+result=$(./show_graph --csv --edges --prefix bl1 2>/dev/null | tail -n +2 | cut -d, -f3-)
+check "show_graph filters edges to CSV" "$result" '^100,"bl1","bl2"$'
+
+echo ""
+
+echo "TEST SUITE 16: Ingest Scaling"
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo ""
+
+# Four times the lines may cost about four times the work, not sixteen:
+# hash probes, edges walked and edges re-sorted into the CSR, as counted
+ingest_work() {
+    awk -v n=$1 'BEGIN { srand(1); for (i = 0; i < n; i++) { line = "";
+        for (k = 0; k < 6; k++) line = line " w" int(rand() * n); print substr(line, 2) } }' > melvin_corpus.txt
+    rm -f melvin.mmap melvin.log
+    ./melvin --batch melvin_corpus.txt --depth 1 --quiet --stats 2>&1 >/dev/null | tr ' ' '\n' |
+        awk -F= '$1 ~ /^(lookup_probes|edge_probes|walk_edges|csr_edges)$/ { sum += $2 } END { print sum }'
+}
+small=$(ingest_work 20000)
+large=$(ingest_work 80000)
+rm -f melvin_corpus.txt
+growth="${small}, then ${large} for 4x the lines"
+[ -n "$small" ] && [ "$large" -le $(( small * 8 )) ] && growth="linear"
+check "Ingest work grows linearly" "$growth" "^linear$"
+
+echo ""
+
+echo "TEST SUITE 17: Server"
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo ""
+
+# Start a server on melvin_test.sock and wait until it accepts
+serve_start() {
+    rm -f melvin_test.sock
+    ./melvin --serve melvin_test.sock > /dev/null 2>&1 &
+    server=$!
+    for i in $(seq 50); do [ -S melvin_test.sock ] && return; sleep 0.1; done
+}
+
+# Send each argument as one request line; print one reply per line
+serve_send() {
+    python3 - "$@" <<'PY'
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.settimeout(5)
+s.connect("melvin_test.sock")
+f = s.makefile("rw")
+for line in sys.argv[1:]:
+    f.write(line + "\n"); f.flush()
+    print(f.readline().rstrip("\n") or "(empty)")
+PY
+}
+
+serve_stop() {
+    serve_send '!SHUTDOWN' > /dev/null 2>&1
+    wait $server
+}
+
+rm -f melvin.mmap melvin.log
+serve_start
+result=$(serve_send "sx1 sx2 sx3" "!QUERY sx1" "!QUERY sxq" "!QUERY sx2" 2>&1)
+check "Server routes a line" "$(echo "$result" | sed -n 1p)" "sx3"
+check "Server answers a query" "$(echo "$result" | sed -n 2p)" "^sx1 → sx2 sx3"
+check "Server answers an unknown query with an empty line" "$(echo "$result" | sed -n 3p)" "^(empty)$"
+check "Server keeps serving after it" "$(echo "$result" | sed -n 4p)" "^sx2 → sx3"
+
+# The server keeps the writer's lock; a CLI query reads past it at once
+result=$(echo "sx1" | timeout 5 ./melvin --query 2>&1)
+check "CLI query doesn't wait for the server" "$result" "^sx1 → sx2 sx3"
+serve_stop
+
+# Changes after a checkpoint unseal the file: a crash must not look like corruption
+serve_start
+serve_send "sy1 sy2" '!SAVE' "sy3 sy4" > /dev/null 2>&1
+kill -9 $server; wait $server 2>/dev/null
+check "Crash after a checkpoint leaves an unsealed file" "$(./show_graph 2>&1 | grep FORMAT)" "changed since last checkpoint"
+
+# A process waiting for the server's lock while !COMPACT swaps the file
+# must learn into the new file, not the old one
+rm -f melvin.mmap melvin.log
+serve_start
+serve_send "sa sb" > /dev/null 2>&1
+(echo "sw1 sw2" | ./melvin > /dev/null 2> melvin_wait.txt) &
+waiter=$!
+for i in $(seq 50); do grep -q "waiting for" melvin_wait.txt 2>/dev/null && break; sleep 0.1; done
+check "Writer waits for the server's lock" "$(cat melvin_wait.txt)" "waiting for melvin.mmap"
+serve_send '!COMPACT' > /dev/null 2>&1
+serve_stop
+wait $waiter
+rm -f melvin_wait.txt
+check "Waiter learns into the compacted file" "$(echo sw1 | ./melvin --query 2>&1)" "^sw1 → sw2"
+check "Compacted graph kept after the waiter" "$(echo sa | ./melvin --query 2>&1)" "^sa → sb"
+
+echo ""
+
+echo "TEST SUITE 18: Query Cache"
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo ""
+
+rm -f melvin.mmap melvin.log
+echo "ca cb cc" | ./melvin > /dev/null 2>&1
+echo "cb cd" | ./melvin > /dev/null 2>&1
+result=$(printf 'ca\nca\n' | ./melvin --query --batch --stats 2>&1 >/dev/null)
+check "Repeated query is a cache hit" "$result" "cache_hits=1 cache_misses=1"
+result=$(printf 'ca\ncb\nca\n' | ./melvin --query --batch --cache 1 --stats 2>&1 >/dev/null)
+check "One-entry cache evicts the older walk" "$result" "cache_hits=0 cache_misses=3"
+result=$(printf 'ca\nca\n' | ./melvin --query --batch --cache 0 --stats 2>&1 >/dev/null)
+check "Cache turned off is never looked up" "$result" "cache_hits=0 cache_misses=0"
+
+# Through the library: a route retires cached walks, and resizing the cache
+# while other threads query it leaves their answers unchanged
+result=$(py <<'PY' 2>&1
+m = lib.melvin_open(b"melvin.mmap", 0)
+before = ask(m, b"ca")
+ask(m, b"ca ce", True)
+after = ask(m, b"ca")
+print("invalidated" if "ce" not in before and "ce" in after else "stale: " + after)
+wrong = []
+def reader(line):
+    want = ask(m, line)
+    for _ in range(2000):
+        if ask(m, line) != want: wrong.append(line)
+threads = [threading.Thread(target=reader, args=(w,)) for w in (b"ca", b"cb", b"cc", b"ca")]
+for t in threads: t.start()
+while any(t.is_alive() for t in threads):
+    for cap in (0, 1, 2, 64): lib.melvin_set_cache(m, cap)
+for t in threads: t.join()
+print("resized" if not wrong else "wrong: %d" % len(wrong))
+lib.melvin_close(m)
+PY
+)
+check "Route retires cached walks" "$result" "^invalidated"
+check "Resizing the cache during queries" "$result" "^resized"
+
+echo ""
+
+echo "TEST SUITE 19: Corrupt Files"
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo ""
+
+# Damage behind an intact header: a sealed file fails its section
+# checksums; an unsealed one (or a copy-in file) its arrays' bounds.
+# Every open must refuse the file and say why, never walk into it.
+rm -f melvin_bad.mmap melvin_bad.log
+result=$(py <<'PY' 2>&1
+import zlib
+def fresh():
+    for f in ("melvin_bad.mmap", "melvin_bad.log"):
+        if os.path.exists(f): os.unlink(f)
+    m = lib.melvin_open(b"melvin_bad.mmap", 0)
+    ask(m, b"ba bb bc", True)
+    lib.melvin_checkpoint(m)
+    lib.melvin_close(m)
+# Overwrite bytes at offset at of section s (0 token_off, 3 arena, 5 edge_to)
+def poke(s, at, data, unseal=False):
+    with open("melvin_bad.mmap", "r+b") as f:
+        h = bytearray(f.read(1152))
+        f.seek(struct.unpack_from("<Q", h, 128 + 32 * s)[0] + at)
+        f.write(data)
+        if unseal:
+            struct.pack_into("<II", h, 8, 0, struct.unpack_from("<I", h, 12)[0] & ~1)
+            struct.pack_into("<I", h, 8, zlib.crc32(h))
+            f.seek(0)
+            f.write(h)
+def opens(flags=0):
+    sys.stderr.flush()
+    m = lib.melvin_open(b"melvin_bad.mmap", flags)
+    if m: lib.melvin_close(m)
+    print("opened" if m else "refused", flush=True)
+fresh(); opens()
+fresh(); poke(3, 0, b"X"); opens(); opens(1)
+fresh(); poke(5, 0, struct.pack("<I", 1 << 20), True); opens()
+fresh(); poke(0, 0, struct.pack("<I", 1 << 20), True); opens(1)
+with open("melvin_bad.mmap", "wb") as f:
+    f.write(struct.pack("<4I", 2, 0, 1, 0) + struct.pack("<16sHi", b"ca", 2, 0) * 2)
+    f.write(struct.pack("<IIB", 0, 7, 100))
+opens()
+PY
+)
+rm -f melvin_bad.mmap melvin_bad.log melvin_bad.mmap.tmp
+check "Sound file opens" "$(echo "$result" | sed -n 1p)" "^opened$"
+check "Sealed file with a bad section is refused" "$(echo "$result" | sed -n 2,5p | tr '\n' ' ')" \
+    "section checksum mismatch refused .*section checksum mismatch refused"
+check "Edge to a missing node is refused" "$(echo "$result" | sed -n 6,7p | tr '\n' ' ')" \
+    "edge to a missing node refused"
+check "Token outside the arena is refused" "$(echo "$result" | sed -n 8,9p | tr '\n' ' ')" \
+    "token outside the arena refused"
+check "Copy-in file with a dangling edge is refused" "$(echo "$result" | sed -n 10,11p | tr '\n' ' ')" \
+    "edge to a missing node refused"
+
 echo ""
 echo "═══════════════════════════════════════════════════════════"
 echo -e "Results: ${GREEN}$passed passed${NC}, ${RED}$failed failed${NC}"